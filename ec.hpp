@@ -13,6 +13,29 @@
 #include "ec/event.hpp"
 #include "ec/definitions.hpp"
 #include "ec/ndrange.hpp"
+#include "ec/profiling.hpp"
+#include "ec/trace.hpp"
+#include "ec/command_graph.hpp"
+#include "ec/scheduler.hpp"
+#include "ec/continuation.hpp"
+#include "ec/wait.hpp"
+#include "ec/completion.hpp"
+#include "ec/arena.hpp"
+#include "ec/buffer_cache.hpp"
+#include "ec/staging.hpp"
+#include "ec/upload_ring.hpp"
+#include "ec/transfer_batcher.hpp"
+#include "ec/device_vector.hpp"
+#include "ec/soa_vector.hpp"
+#include "ec/mirrored_buffer.hpp"
+#include "ec/host_memory.hpp"
+#include "ec/transfer.hpp"
+#include "ec/stream_processor.hpp"
+#include "ec/file_buffer.hpp"
+#include "ec/file_ingest.hpp"
+#include "ec/checkpoint.hpp"
+#include "ec/program_cache.hpp"
+#include "ec/coroutine.hpp"
 
 #undef EC_SET_ERRP
 #undef EC_CHECK_ERROR
@@ -0,0 +1,303 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "device.hpp"
+#include "memory.hpp"
+#include "buffer.hpp"
+#include "buffer_create_type.hpp"
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ec
+{
+
+// suballocates sub-buffers from a few large backing buffers , so a
+// temporary costs a clCreateSubBuffer instead of a device allocation.
+// region origins are aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN.
+//
+// BUMP      allocations only advance a cursor; reset() recycles everything
+//           at once , e.g. once per frame after the frame's commands finished.
+// FREE_LIST a region returns to its block when the last reference to its
+//           sub-buffer is released , through a destructor callback;
+//           adjacent free regions are merged.
+class BufferArena
+{
+public:
+  enum mode_t { BUMP , FREE_LIST };
+
+protected:
+  struct block_t
+  {
+    Buffer buffer;
+    size_t size;
+    size_t cursor;
+    // FREE_LIST: offset -> size of every free region
+    std::map< size_t , size_t > free;
+  };
+  struct region_t
+  {
+    size_t block;
+    size_t offset;
+    size_t size;
+  };
+  // outlives the arena while FREE_LIST sub-buffers are alive
+  struct state_t
+  {
+    std::mutex mutex;
+    std::vector< block_t > blocks;
+    std::unordered_map< cl_mem , region_t > live;
+    std::atomic< size_t > refs{ 1 };
+    size_t used = 0;
+
+    void unref()
+    {
+      if( refs.fetch_sub( 1 ) == 1 )
+      {
+        delete this;
+      }
+    }
+    void free_( region_t const& r )
+    {
+      auto& free = blocks[ r.block ].free;
+      size_t offset = r.offset;
+      size_t size = r.size;
+      auto next = free.lower_bound( offset );
+      if( next != free.end() && offset + size == next->first )
+      {
+        size += next->second;
+        next = free.erase( next );
+      }
+      if( next != free.begin() )
+      {
+        auto prev = std::prev( next );
+        if( prev->first + prev->second == offset )
+        {
+          prev->second += size;
+          return;
+        }
+      }
+      free.emplace_hint( next , offset , size );
+    }
+    static void destructor_( cl_mem mem , void* userdata )
+    {
+      state_t* self = static_cast< state_t* >( userdata );
+      {
+        std::lock_guard< std::mutex > lock( self->mutex );
+        auto it = self->live.find( mem );
+        self->used -= it->second.size;
+        self->free_( it->second );
+        self->live.erase( it );
+      }
+      self->unref();
+    }
+  };
+
+  cl_context context_;
+  cl_mem_flags flags_;
+  size_t block_size_;
+  size_t alignment_;
+  mode_t mode_;
+  state_t* state_;
+
+  size_t align_( size_t x ) const
+  {
+    return ( x + alignment_ - 1 ) / alignment_ * alignment_;
+  }
+  // new backing buffer of at least size bytes; returns its index
+  size_t grow_( size_t size , int* errp )
+  {
+    const size_t bytes = std::max( block_size_ , size );
+    Buffer buffer( context_ , flags_ , bytes , nullptr , errp );
+    if( !buffer )
+    {
+      return SIZE_MAX;
+    }
+    block_t block{ std::move( buffer ) , bytes , 0 , {} };
+    if( mode_ == FREE_LIST )
+    {
+      block.free.emplace( 0 , bytes );
+    }
+    state_->blocks.push_back( std::move( block ) );
+    return state_->blocks.size() - 1;
+  }
+  bool find_bump_( size_t size , region_t& r , int* errp )
+  {
+    auto& blocks = state_->blocks;
+    for( size_t i=0; i<blocks.size(); ++i )
+    {
+      if( blocks[i].size - blocks[i].cursor >= size )
+      {
+        r = { i , blocks[i].cursor , size };
+        blocks[i].cursor += size;
+        return true;
+      }
+    }
+    const size_t i = grow_( size , errp );
+    if( i == SIZE_MAX )
+    {
+      return false;
+    }
+    r = { i , 0 , size };
+    blocks[i].cursor = size;
+    return true;
+  }
+  bool find_free_( size_t size , region_t& r , int* errp )
+  {
+    auto& blocks = state_->blocks;
+    size_t i = 0;
+    std::map< size_t , size_t >::iterator it;
+    for( ; i<blocks.size(); ++i )
+    {
+      auto& free = blocks[i].free;
+      it = std::find_if( free.begin() , free.end() ,
+          [size]( std::pair< const size_t , size_t > const& f ){ return f.second >= size; } );
+      if( it != free.end() )
+      {
+        break;
+      }
+    }
+    if( i == blocks.size() )
+    {
+      i = grow_( size , errp );
+      if( i == SIZE_MAX )
+      {
+        return false;
+      }
+      it = blocks[i].free.begin();
+    }
+    r = { i , it->first , size };
+    if( it->second > size )
+    {
+      blocks[i].free.emplace_hint( std::next( it ) , it->first + size , it->second - size );
+    }
+    blocks[i].free.erase( it );
+    return true;
+  }
+
+public:
+  // block_size is the size of each backing buffer; larger requests get a
+  // dedicated block. flags apply to the backing buffers.
+  BufferArena( cl_context context , cl_device_id device ,
+      mode_t mode=BUMP ,
+      size_t block_size=size_t(16)<<20 ,
+      cl_mem_flags flags=CL_MEM_READ_WRITE ,
+      int* errp=nullptr )
+    : context_( context ) ,
+      flags_( flags ) ,
+      block_size_( block_size ) ,
+      alignment_( 1 ) ,
+      mode_( mode ) ,
+      state_( new state_t )
+  {
+    // reported in bits
+    const cl_uint bits = Device( device ).get_info< CL_DEVICE_MEM_BASE_ADDR_ALIGN >( errp );
+    alignment_ = std::max< size_t >( bits / 8 , 1 );
+  }
+  BufferArena( BufferArena const& ) = delete;
+  BufferArena& operator=( BufferArena const& ) = delete;
+  ~BufferArena()
+  {
+    state_->unref();
+  }
+
+  // sub-buffer of at least size bytes; it keeps its backing buffer alive
+  Buffer allocate( size_t size , int* errp=nullptr )
+  {
+    size = align_( std::max< size_t >( size , 1 ) );
+    std::lock_guard< std::mutex > lock( state_->mutex );
+    region_t r;
+    if( !( mode_ == BUMP ? find_bump_( size , r , errp ) : find_free_( size , r , errp ) ) )
+    {
+      return {};
+    }
+    int err;
+    Buffer ret( clCreateSubBuffer( state_->blocks[ r.block ].buffer , 0 ,
+          buffer_create_range::value , buffer_create_range( r.offset , r.size ).data() ,
+          &err ) , no_retain_t() );
+    if( err == CL_SUCCESS && mode_ == FREE_LIST )
+    {
+      state_->refs.fetch_add( 1 );
+      err = clSetMemObjectDestructorCallback( ret , state_t::destructor_ , state_ );
+      if( err == CL_SUCCESS )
+      {
+        state_->live.emplace( ret.get() , r );
+      }
+      else
+      {
+        state_->refs.fetch_sub( 1 );
+        ret = Buffer();
+      }
+    }
+    if( err != CL_SUCCESS )
+    {
+      if( mode_ == FREE_LIST )
+      {
+        state_->free_( r );
+      }
+      else
+      {
+        state_->blocks[ r.block ].cursor = r.offset;
+      }
+    }
+    EC_CHECK_ERROR( err , errp , return {} )
+    EC_SET_ERRP( errp )
+    state_->used += r.size;
+    return ret;
+  }
+
+  // BUMP: rewinds every block. sub-buffers handed out so far must no
+  // longer be used by any command.
+  void reset()
+  {
+    std::lock_guard< std::mutex > lock( state_->mutex );
+    if( mode_ == BUMP )
+    {
+      for( auto& b : state_->blocks )
+      {
+        b.cursor = 0;
+      }
+      state_->used = 0;
+    }
+  }
+
+  mode_t mode() const
+  {
+    return mode_;
+  }
+  // region origin and size granularity , in bytes
+  size_t alignment() const
+  {
+    return alignment_;
+  }
+  // bytes handed out , after rounding to alignment()
+  size_t used() const
+  {
+    std::lock_guard< std::mutex > lock( state_->mutex );
+    return state_->used;
+  }
+  // bytes held in backing buffers
+  size_t reserved() const
+  {
+    std::lock_guard< std::mutex > lock( state_->mutex );
+    size_t ret = 0;
+    for( auto const& b : state_->blocks )
+    {
+      ret += b.size;
+    }
+    return ret;
+  }
+  size_t blocks() const
+  {
+    std::lock_guard< std::mutex > lock( state_->mutex );
+    return state_->blocks.size();
+  }
+};
+
+}
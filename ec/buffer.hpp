@@ -77,6 +77,12 @@ inline Buffer Buffer::sub_buffer( cl_mem_flags flags , buffer_create_range const
   const cl_mem ret = clCreateSubBuffer( get() , 
       flags , buffer_create_range::value , data.data() , &err );
   EC_CHECK_ERROR( err , errp , return {} )
+  const detail::retain_hook_t hook = detail::retain_hook().load( std::memory_order_acquire );
+  if( hook != nullptr )
+  {
+    // the runtime reference the sub-buffer holds is not a Memory's
+    hook( get() , true );
+  }
   EC_SET_ERRP( errp )
   return { ret , no_retain_t() };
 }
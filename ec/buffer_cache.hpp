@@ -0,0 +1,335 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "memory.hpp"
+#include "buffer.hpp"
+#include <algorithm>
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ec
+{
+
+// opt-in caching allocator for Buffers.
+// buffers from allocate() are rounded up to a size class; when the last
+// Buffer referring to one is released , the cache keeps the cl_mem instead of
+// returning it to the driver , and the next allocate() of the same
+// ( context , flags , size class ) gets it back.
+// cached bytes are capped; the least recently released buffers go first.
+//
+// a buffer counts as released when the last Memory handle to it goes; the
+// cache counts the handles itself , since the runtime's reference count is
+// not reliable. references taken past the handles , like a raw
+// clRetainMemObject , are not seen: keep such buffers alive through a
+// Buffer. a buffer that had a sub-buffer is never recycled , and one must
+// be unmapped before its last handle goes.
+// a recycled buffer may be handed out while commands enqueued before its
+// release still run. that is safe on one in-order queue; with several
+// queues , synchronize before dropping the last reference.
+// while any cache exists , every Memory copy and release takes one shared
+// lock.
+class BufferCache
+{
+public:
+  struct class_stats_t
+  {
+    cl_context context;
+    cl_mem_flags flags;
+    size_t size;
+    size_t hits;
+    size_t misses;
+    // buffers of this class held by the cache right now
+    size_t cached;
+  };
+
+protected:
+  using key_t = std::tuple< cl_context , cl_mem_flags , size_t >;
+  struct cached_t
+  {
+    cl_mem mem;
+    key_t key;
+  };
+  struct class_t
+  {
+    size_t hits = 0;
+    size_t misses = 0;
+    // most recently released last
+    std::vector< std::list< cached_t >::iterator > free;
+  };
+  struct owner_t
+  {
+    BufferCache* cache;
+    key_t key;
+    // live Memory handles , 0 while cached
+    size_t handles;
+  };
+
+  // every cache shares one lock and one registry , so the release hook
+  // can tell which cache , if any , a cl_mem came from
+  struct registry_t
+  {
+    std::mutex mutex;
+    std::unordered_map< cl_mem , owner_t > owned;
+    size_t caches = 0;
+  };
+  static registry_t& registry_()
+  {
+    static registry_t ret;
+    return ret;
+  }
+
+  size_t max_bytes_;
+  size_t cached_bytes_ = 0;
+  std::map< key_t , class_t > classes_;
+  // most recently released first
+  std::list< cached_t > lru_;
+
+  // evicts least recently released buffers down to bytes;
+  // the caller releases them after unlocking
+  void trim_( size_t bytes , std::vector< cl_mem >& released )
+  {
+    registry_t& reg = registry_();
+    while( cached_bytes_ > bytes && !lru_.empty() )
+    {
+      cached_t const& c = lru_.back();
+      auto& free = classes_[ c.key ].free;
+      free.erase( std::find( free.begin() , free.end() , std::prev( lru_.end() ) ) );
+      cached_bytes_ -= std::get<2>( c.key );
+      reg.owned.erase( c.mem );
+      released.push_back( c.mem );
+      lru_.pop_back();
+    }
+  }
+  static void release_all_( std::vector< cl_mem > const& released )
+  {
+    for( cl_mem mem : released )
+    {
+      clReleaseMemObject( mem );
+    }
+  }
+
+  // Memory::release_if hook
+  static bool reclaim_( cl_mem mem )
+  {
+    registry_t& reg = registry_();
+    std::vector< cl_mem > released;
+    {
+      std::lock_guard< std::mutex > lock( reg.mutex );
+      auto it = reg.owned.find( mem );
+      if( it == reg.owned.end() )
+      {
+        return false;
+      }
+      // other handles keep it , each holds its own runtime reference
+      if( --it->second.handles != 0 )
+      {
+        return false;
+      }
+      BufferCache* self = it->second.cache;
+      const key_t key = it->second.key;
+      const size_t size = std::get<2>( key );
+      if( size > self->max_bytes_ )
+      {
+        reg.owned.erase( it );
+        return false;
+      }
+      self->trim_( self->max_bytes_ - size , released );
+      self->lru_.push_front( { mem , key } );
+      self->classes_[ key ].free.push_back( self->lru_.begin() );
+      self->cached_bytes_ += size;
+    }
+    release_all_( released );
+    return true;
+  }
+  // Memory::retain_if and Buffer::sub_buffer hook
+  static void retained_( cl_mem mem , bool pin )
+  {
+    registry_t& reg = registry_();
+    std::lock_guard< std::mutex > lock( reg.mutex );
+    auto it = reg.owned.find( mem );
+    if( it == reg.owned.end() )
+    {
+      return;
+    }
+    if( pin )
+    {
+      // the sub-buffer's reference is invisible , leave it to the driver
+      reg.owned.erase( it );
+    }
+    else
+    {
+      ++it->second.handles;
+    }
+  }
+  // a cl_mem of ours was really deleted , e.g. after being released while
+  // a copy or a map was still alive
+  static void forget_( cl_mem mem , void* )
+  {
+    registry_t& reg = registry_();
+    std::lock_guard< std::mutex > lock( reg.mutex );
+    reg.owned.erase( mem );
+  }
+
+public:
+  // 256 bytes and up , with four classes per power of two
+  static size_t size_class( size_t size )
+  {
+    if( size <= 256 )
+    {
+      return 256;
+    }
+    const size_t n = size - 1;
+    unsigned msb = 0;
+    while( ( n >> msb ) > 1 )
+    {
+      ++msb;
+    }
+    const size_t step = size_t(1) << ( msb - 2 );
+    return ( n / step + 1 ) * step;
+  }
+
+  explicit BufferCache( size_t max_bytes=size_t(256)<<20 )
+    : max_bytes_( max_bytes )
+  {
+    registry_t& reg = registry_();
+    std::lock_guard< std::mutex > lock( reg.mutex );
+    if( reg.caches++ == 0 )
+    {
+      detail::release_hook().store( &BufferCache::reclaim_ , std::memory_order_release );
+      detail::retain_hook().store( &BufferCache::retained_ , std::memory_order_release );
+    }
+  }
+  BufferCache( BufferCache const& ) = delete;
+  BufferCache& operator=( BufferCache const& ) = delete;
+  // releases every cached buffer; buffers still in use are released
+  // to the driver as usual
+  ~BufferCache()
+  {
+    registry_t& reg = registry_();
+    std::vector< cl_mem > released;
+    {
+      std::lock_guard< std::mutex > lock( reg.mutex );
+      trim_( 0 , released );
+      for( auto it=reg.owned.begin(); it!=reg.owned.end(); )
+      {
+        it = it->second.cache == this ? reg.owned.erase( it ) : std::next( it );
+      }
+      if( --reg.caches == 0 )
+      {
+        detail::release_hook().store( nullptr , std::memory_order_release );
+        detail::retain_hook().store( nullptr , std::memory_order_release );
+      }
+    }
+    release_all_( released );
+  }
+
+  // buffer of size_class( size ) bytes
+  Buffer allocate( cl_context context , cl_mem_flags flags , size_t size ,
+      int* errp=nullptr )
+  {
+    const key_t key( context , flags , size_class( size ) );
+    registry_t& reg = registry_();
+    {
+      std::lock_guard< std::mutex > lock( reg.mutex );
+      class_t& c = classes_[ key ];
+      if( !c.free.empty() )
+      {
+        auto it = c.free.back();
+        c.free.pop_back();
+        const cl_mem mem = it->mem;
+        lru_.erase( it );
+        reg.owned[ mem ].handles = 1;
+        cached_bytes_ -= std::get<2>( key );
+        ++c.hits;
+        EC_SET_ERRP( errp )
+        // the cache's reference moves to the caller
+        return { mem , no_retain_t() };
+      }
+      ++c.misses;
+    }
+    int err;
+    const cl_mem mem = clCreateBuffer( context , flags , std::get<2>( key ) , nullptr , &err );
+    EC_CHECK_ERROR( err , errp , return {} )
+    Buffer ret( mem , no_retain_t() );
+    err = clSetMemObjectDestructorCallback( mem , &BufferCache::forget_ , nullptr );
+    EC_CHECK_ERROR( err , errp , return ret )
+    {
+      std::lock_guard< std::mutex > lock( reg.mutex );
+      reg.owned.emplace( mem , owner_t{ this , key , 1 } );
+    }
+    EC_SET_ERRP( errp )
+    return ret;
+  }
+
+  // releases least recently cached buffers until at most bytes are cached
+  void trim( size_t bytes=0 )
+  {
+    std::vector< cl_mem > released;
+    {
+      std::lock_guard< std::mutex > lock( registry_().mutex );
+      trim_( bytes , released );
+    }
+    release_all_( released );
+  }
+  void set_max_bytes( size_t bytes )
+  {
+    std::vector< cl_mem > released;
+    {
+      std::lock_guard< std::mutex > lock( registry_().mutex );
+      max_bytes_ = bytes;
+      trim_( bytes , released );
+    }
+    release_all_( released );
+  }
+  size_t max_bytes() const
+  {
+    std::lock_guard< std::mutex > lock( registry_().mutex );
+    return max_bytes_;
+  }
+  size_t cached_bytes() const
+  {
+    std::lock_guard< std::mutex > lock( registry_().mutex );
+    return cached_bytes_;
+  }
+
+  std::vector< class_stats_t > stats() const
+  {
+    std::lock_guard< std::mutex > lock( registry_().mutex );
+    std::vector< class_stats_t > ret;
+    ret.reserve( classes_.size() );
+    for( auto const& c : classes_ )
+    {
+      ret.push_back( { std::get<0>( c.first ) , std::get<1>( c.first ) , std::get<2>( c.first ) ,
+          c.second.hits , c.second.misses , c.second.free.size() } );
+    }
+    return ret;
+  }
+  size_t hits() const
+  {
+    std::lock_guard< std::mutex > lock( registry_().mutex );
+    size_t ret = 0;
+    for( auto const& c : classes_ )
+    {
+      ret += c.second.hits;
+    }
+    return ret;
+  }
+  size_t misses() const
+  {
+    std::lock_guard< std::mutex > lock( registry_().mutex );
+    size_t ret = 0;
+    for( auto const& c : classes_ )
+    {
+      ret += c.second.misses;
+    }
+    return ret;
+  }
+};
+
+}
@@ -0,0 +1,469 @@
+#pragma once
+
+// named buffers and images saved to and restored from one file; POSIX only.
+#if defined(__linux__) || defined(__APPLE__) || defined(__unix__)
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "definitions.hpp"
+#include "image.hpp"
+#include "file_buffer.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace ec
+{
+
+// the objects of a checkpoint by name. buffers and images have separate
+// namespaces
+struct Checkpoint
+{
+  std::map< std::string , Buffer > buffers;
+  std::map< std::string , Image > images;
+};
+
+namespace detail
+{
+
+// file layout , native byte order:
+//   checkpoint_header_
+//   checkpoint_record_ [count]
+//   names , not terminated
+//   payloads , each starting on a 4 KiB boundary
+// images are stored tightly packed , rows of width * element_size bytes
+constexpr size_t checkpoint_align_ = 4096;
+constexpr char checkpoint_magic_[8] = { 'E' , 'C' , 'C' , 'K' , 'P' , 'T' , 0 , 0 };
+constexpr uint32_t checkpoint_version_ = 1;
+
+struct checkpoint_header_
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+  // header , records and names
+  uint64_t index_size;
+  // of records and names
+  uint64_t index_checksum;
+};
+struct checkpoint_record_
+{
+  uint64_t offset;
+  uint64_t size;
+  uint64_t checksum;
+  uint64_t name_offset;
+  uint32_t name_size;
+  // CL_MEM_OBJECT_BUFFER or one of the image types
+  uint32_t type;
+  uint32_t channel_order;
+  uint32_t channel_data_type;
+  uint64_t element_size;
+  uint64_t width;
+  uint64_t height;
+  uint64_t depth;
+  uint64_t array_size;
+};
+static_assert( sizeof(checkpoint_header_) == 32 , "checkpoint header layout" );
+static_assert( sizeof(checkpoint_record_) == 88 , "checkpoint record layout" );
+
+inline size_t checkpoint_round_( size_t size )
+{
+  return ( size + checkpoint_align_ - 1 ) / checkpoint_align_ * checkpoint_align_;
+}
+
+// fletcher-style sums over 32-bit words , the tail zero-padded
+inline uint64_t checkpoint_checksum_( void const* data , size_t size )
+{
+  const unsigned char* p = static_cast< const unsigned char* >( data );
+  uint64_t a = size;
+  uint64_t b = 0;
+  size_t i = 0;
+  for( ; i+4<=size; i+=4 )
+  {
+    uint32_t word;
+    std::memcpy( &word , p + i , 4 );
+    a += word;
+    b += a;
+  }
+  if( i < size )
+  {
+    uint32_t word = 0;
+    std::memcpy( &word , p + i , size - i );
+    a += word;
+    b += a;
+  }
+  return a ^ ( b << 32 | b >> 32 );
+}
+
+// read_image / write_image region of a packed image
+inline ImageSize checkpoint_region_( checkpoint_record_ const& r )
+{
+  switch( r.type )
+  {
+  case CL_MEM_OBJECT_IMAGE1D_ARRAY:
+    return ImageSize( r.width , r.array_size );
+  case CL_MEM_OBJECT_IMAGE2D:
+    return ImageSize( r.width , r.height );
+  case CL_MEM_OBJECT_IMAGE2D_ARRAY:
+    return ImageSize( r.width , r.height , r.array_size );
+  case CL_MEM_OBJECT_IMAGE3D:
+    return ImageSize( r.width , r.height , r.depth );
+  default:
+    return ImageSize( r.width );
+  }
+}
+
+// bytes of the packed image r describes; false on overflow
+inline bool checkpoint_image_size_( checkpoint_record_ const& r , uint64_t& size )
+{
+  const ImageSize region = checkpoint_region_( r );
+  size = r.element_size;
+  for( size_t i=0; i<3; ++i )
+  {
+    const uint64_t n = region.data()[i];
+    if( n != 0 && size > UINT64_MAX / n )
+    {
+      return false;
+    }
+    size *= n;
+  }
+  return true;
+}
+
+inline checkpoint_record_ checkpoint_describe_( Image const& image , int* errp )
+{
+  checkpoint_record_ r;
+  std::memset( &r , 0 , sizeof(r) );
+  const cl_image_format format = image.format( errp );
+  r.type = image.type( errp );
+  r.channel_order = format.image_channel_order;
+  r.channel_data_type = format.image_channel_data_type;
+  r.element_size = image.element_size( errp );
+  r.width = image.width( errp );
+  r.height = image.height( errp );
+  r.depth = image.depth( errp );
+  r.array_size = image.array_size( errp );
+  checkpoint_image_size_( r , r.size );
+  return r;
+}
+
+}
+
+// writes every object of checkpoint to path , replacing the file only once
+// the new one is complete and synced. objects are read straight into a
+// shared mapping of the file; blocks until done
+inline void save_checkpoint( CommandQueue const& queue , const char* path ,
+    Checkpoint const& checkpoint ,
+    int* errp=nullptr )
+{
+  std::vector< detail::checkpoint_record_ > records;
+  std::vector< cl_mem > objects;
+  std::string names;
+  for( auto const& b : checkpoint.buffers )
+  {
+    detail::checkpoint_record_ r;
+    std::memset( &r , 0 , sizeof(r) );
+    r.type = CL_MEM_OBJECT_BUFFER;
+    r.size = b.second.size( errp );
+    r.name_offset = names.size();
+    r.name_size = static_cast< uint32_t >( b.first.size() );
+    names += b.first;
+    records.push_back( r );
+    objects.push_back( b.second.get() );
+  }
+  for( auto const& i : checkpoint.images )
+  {
+    detail::checkpoint_record_ r = detail::checkpoint_describe_( i.second , errp );
+    r.name_offset = names.size();
+    r.name_size = static_cast< uint32_t >( i.first.size() );
+    names += i.first;
+    records.push_back( r );
+    objects.push_back( i.second.get() );
+  }
+
+  const size_t index_size = sizeof(detail::checkpoint_header_) +
+    records.size() * sizeof(detail::checkpoint_record_) + names.size();
+  size_t file_size = detail::checkpoint_round_( index_size );
+  for( auto& r : records )
+  {
+    r.name_offset += sizeof(detail::checkpoint_header_) +
+      records.size() * sizeof(detail::checkpoint_record_);
+    r.offset = file_size;
+    file_size = detail::checkpoint_round_( file_size + r.size );
+  }
+
+  // written next to path and renamed over it , so a crash keeps the old one
+  struct file_t
+  {
+    CommandQueue const& queue;
+    std::string path;
+    int fd = -1;
+    char* data = static_cast< char* >( MAP_FAILED );
+    size_t size = 0;
+    bool done = false;
+    ~file_t()
+    {
+      // reads may still target the mapping after an error
+      queue.finish();
+      if( data != MAP_FAILED )
+      {
+        ::munmap( data , size );
+      }
+      if( fd >= 0 )
+      {
+        ::close( fd );
+      }
+      if( !done )
+      {
+        ::unlink( path.c_str() );
+      }
+    }
+  } file{ queue , std::string( path ) + ".tmp" };
+  file.fd = ::open( file.path.c_str() , O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC , 0644 );
+  if( file.fd < 0 || ::ftruncate( file.fd , static_cast< off_t >( file_size ) ) != 0 )
+  {
+    EC_CHECK_ERROR( CL_INVALID_VALUE , errp , return )
+  }
+  file.data = static_cast< char* >( ::mmap( nullptr , file_size , PROT_READ | PROT_WRITE ,
+        MAP_SHARED , file.fd , 0 ) );
+  if( file.data == MAP_FAILED )
+  {
+    EC_CHECK_ERROR( CL_OUT_OF_HOST_MEMORY , errp , return )
+  }
+  file.size = file_size;
+
+  std::vector< Event > reads( records.size() );
+  for( size_t i=0; i<records.size(); ++i )
+  {
+    auto const& r = records[i];
+    if( r.size == 0 )
+    {
+      continue;
+    }
+    char* dst = file.data + r.offset;
+    reads[i] = r.type == CL_MEM_OBJECT_BUFFER ?
+      queue.read_buffer( objects[i] , CL_FALSE , 0 , r.size , dst , nullptr , errp ) :
+      queue.read_image( objects[i] , CL_FALSE , ImageOffset() , detail::checkpoint_region_( r ) ,
+          ImagePitch() , dst , nullptr , errp );
+    if( !reads[i] )
+    {
+      return;
+    }
+  }
+  queue.flush();
+  for( size_t i=0; i<records.size(); ++i )
+  {
+    if( reads[i] )
+    {
+      // checksums of earlier objects overlap later reads
+      int err;
+      reads[i].wait( &err );
+      EC_CHECK_ERROR( err , errp , return )
+    }
+    records[i].checksum = detail::checkpoint_checksum_( file.data + records[i].offset ,
+        records[i].size );
+  }
+
+  detail::checkpoint_header_ header;
+  std::memcpy( header.magic , detail::checkpoint_magic_ , sizeof(header.magic) );
+  header.version = detail::checkpoint_version_;
+  header.count = static_cast< uint32_t >( records.size() );
+  header.index_size = index_size;
+  char* index = file.data + sizeof(header);
+  if( !records.empty() )
+  {
+    std::memcpy( index , records.data() , records.size() * sizeof(records[0]) );
+  }
+  std::memcpy( index + records.size() * sizeof(records[0]) , names.data() , names.size() );
+  header.index_checksum = detail::checkpoint_checksum_( index , index_size - sizeof(header) );
+  std::memcpy( file.data , &header , sizeof(header) );
+
+  if( ::msync( file.data , file.size , MS_SYNC ) != 0 || ::fsync( file.fd ) != 0 ||
+      ::rename( file.path.c_str() , path ) != 0 )
+  {
+    EC_CHECK_ERROR( CL_INVALID_VALUE , errp , return )
+  }
+  file.done = true;
+  EC_SET_ERRP( errp )
+}
+
+// restores the objects saved at path into checkpoint. objects already in
+// checkpoint are overwritten and must match the saved size , format and
+// dimensions; missing ones are created with flags in the queue's context.
+// objects of checkpoint not in the file are left alone.
+// every payload is checked against its checksum and written straight from
+// a mapping of the file , which is unmapped once the writes completed.
+// does not block; the returned event completes once everything is
+// restored. on error some objects may already be overwritten
+inline Event load_checkpoint( CommandQueue const& queue , const char* path ,
+    Checkpoint& checkpoint ,
+    cl_mem_flags flags=CL_MEM_READ_WRITE ,
+    int* errp=nullptr )
+{
+  auto file = std::make_shared< MappedFile >( path , errp );
+  if( !*file )
+  {
+    return {};
+  }
+  char const* data = static_cast< char const* >( file->data() );
+  detail::checkpoint_header_ header;
+  int err = CL_SUCCESS;
+  if( file->size() < sizeof(header) )
+  {
+    err = CL_INVALID_VALUE;
+  }
+  else
+  {
+    std::memcpy( &header , data , sizeof(header) );
+    if( std::memcmp( header.magic , detail::checkpoint_magic_ , sizeof(header.magic) ) != 0 ||
+        header.version != detail::checkpoint_version_ ||
+        header.index_size > file->size() ||
+        header.index_size < sizeof(header) + uint64_t( header.count ) * sizeof(detail::checkpoint_record_) ||
+        detail::checkpoint_checksum_( data + sizeof(header) , header.index_size - sizeof(header) ) !=
+          header.index_checksum )
+    {
+      err = CL_INVALID_VALUE;
+    }
+  }
+  EC_CHECK_ERROR( err , errp , return {} )
+
+  std::vector< detail::checkpoint_record_ > records( header.count );
+  if( header.count != 0 )
+  {
+    std::memcpy( records.data() , data + sizeof(header) , records.size() * sizeof(records[0]) );
+  }
+  for( auto const& r : records )
+  {
+    if( r.offset > file->size() || r.size > file->size() - r.offset ||
+        r.name_offset > header.index_size || r.name_size > header.index_size - r.name_offset )
+    {
+      EC_CHECK_ERROR( CL_INVALID_VALUE , errp , return {} )
+    }
+  }
+
+  const Context context = queue.context( errp );
+  file->advise( 0 , file->size() , POSIX_MADV_SEQUENTIAL );
+  std::vector< Event > writes;
+  std::vector< cl_event > events;
+  for( size_t i=0; i<records.size(); ++i )
+  {
+    auto const& r = records[i];
+    const std::string name( data + r.name_offset , r.name_size );
+    char const* payload = data + r.offset;
+    // fault in the next payload while this one is checked and written
+    if( i + 1 < records.size() )
+    {
+      file->advise( records[i+1].offset , records[i+1].size , POSIX_MADV_WILLNEED );
+    }
+    if( detail::checkpoint_checksum_( payload , r.size ) != r.checksum )
+    {
+      EC_CHECK_ERROR( CL_INVALID_VALUE , errp , return {} )
+    }
+
+    Event write;
+    if( r.type == CL_MEM_OBJECT_BUFFER )
+    {
+      Buffer& buffer = checkpoint.buffers[ name ];
+      if( !buffer )
+      {
+        buffer = Buffer( context , flags , r.size , nullptr , errp );
+        if( !buffer )
+        {
+          return {};
+        }
+      }
+      else if( buffer.size( errp ) != r.size )
+      {
+        EC_CHECK_ERROR( CL_INVALID_BUFFER_SIZE , errp , return {} )
+      }
+      if( r.size == 0 )
+      {
+        continue;
+      }
+      write = queue.write_buffer( buffer , CL_FALSE , 0 , r.size , payload , nullptr , errp );
+    }
+    else
+    {
+      Image& image = checkpoint.images[ name ];
+      if( !image )
+      {
+        // the payload must fill the image the record describes
+        uint64_t size;
+        if( !detail::checkpoint_image_size_( r , size ) || size != r.size )
+        {
+          EC_CHECK_ERROR( CL_INVALID_IMAGE_SIZE , errp , return {} )
+        }
+        cl_image_format format;
+        format.image_channel_order = r.channel_order;
+        format.image_channel_data_type = r.channel_data_type;
+        cl_image_desc desc;
+        std::memset( &desc , 0 , sizeof(desc) );
+        desc.image_type = r.type;
+        desc.image_width = r.width;
+        desc.image_height = r.height;
+        desc.image_depth = r.depth;
+        desc.image_array_size = r.array_size;
+        image = Image( context , flags , &format , &desc , nullptr , errp );
+        if( !image )
+        {
+          return {};
+        }
+        // and the recorded element size must be the format's
+        if( image.element_size( errp ) != r.element_size )
+        {
+          EC_CHECK_ERROR( CL_INVALID_IMAGE_SIZE , errp , return {} )
+        }
+      }
+      else
+      {
+        const detail::checkpoint_record_ current = detail::checkpoint_describe_( image , errp );
+        if( current.channel_order != r.channel_order ||
+            current.channel_data_type != r.channel_data_type )
+        {
+          EC_CHECK_ERROR( CL_IMAGE_FORMAT_MISMATCH , errp , return {} )
+        }
+        if( current.type != r.type || current.size != r.size ||
+            current.width != r.width || current.height != r.height ||
+            current.depth != r.depth || current.array_size != r.array_size )
+        {
+          EC_CHECK_ERROR( CL_INVALID_IMAGE_SIZE , errp , return {} )
+        }
+      }
+      write = queue.write_image( image , CL_FALSE , ImageOffset() , detail::checkpoint_region_( r ) ,
+          ImagePitch() , payload , nullptr , errp );
+    }
+    if( !write )
+    {
+      return {};
+    }
+    // every write keeps the mapping until it completed
+    auto held = new std::shared_ptr< MappedFile >( file );
+    err = clSetEventCallback( write.get() , CL_COMPLETE , detail::release_mapping_ , held );
+    if( err != CL_SUCCESS )
+    {
+      write.wait();
+      delete held;
+    }
+    EC_CHECK_ERROR( err , errp , return {} )
+    events.push_back( write.get() );
+    writes.push_back( std::move( write ) );
+  }
+  queue.flush();
+  EC_SET_ERRP( errp )
+  if( writes.size() == 1 )
+  {
+    return std::move( writes.back() );
+  }
+  return queue.marker( events , errp );
+}
+
+}
+
+#endif
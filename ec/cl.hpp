@@ -43,4 +43,7 @@ public:
 
 struct no_retain_t {};
 struct retain_t {};
+// pass as first argument of a CommandQueue enqueue to skip event creation
+struct no_event_t {};
+constexpr no_event_t no_event{};
 }
@@ -0,0 +1,430 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "event.hpp"
+#include "memory.hpp"
+#include "kernel.hpp"
+#include "command_queue.hpp"
+#include "ndrange.hpp"
+#include "list_view.hpp"
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ec
+{
+
+// records a sequence of CommandQueue operations once and replays it
+// onto any queue.
+//
+// every buffer , host pointer , fill pattern and kernel argument lives in
+// a value slot. slots created with slot() can be patched with set()
+// between replays; plain values passed while recording become constant
+// slots. kernel arguments are re-applied from the slots on every replay ,
+// in recording order , so a kernel may be used several times with
+// different arguments.
+//
+// replay() creates a cl_event only for commands that another command
+// depends on , plus the last one; everything else is enqueued without an
+// event. buffers and host memory referenced by the graph are not
+// retained and must outlive every replay.
+class CommandGraph
+{
+public:
+  template < typename T >
+  struct Slot
+  {
+    cl_uint index;
+  };
+  struct Node
+  {
+    cl_uint index;
+  };
+
+  // a recorded argument: either a constant or a patchable slot
+  template < typename T >
+  class Value
+  {
+    friend class CommandGraph;
+    T value_;
+    cl_uint slot_;
+    bool is_slot_;
+
+  public:
+    template < typename U ,
+      typename = std::enable_if_t< std::is_convertible< U&& , T >::value > >
+    Value( U&& value )
+      : value_( std::forward< U >( value ) ) ,
+        slot_( 0 ) ,
+        is_slot_( false )
+    {
+    }
+    Value( Slot< T > slot )
+      : value_() ,
+        slot_( slot.index ) ,
+        is_slot_( true )
+    {
+    }
+  };
+
+protected:
+  enum class op_t : cl_uint
+  {
+    set_arg ,
+    write_buffer ,
+    read_buffer ,
+    copy_buffer ,
+    fill_buffer ,
+    ndrange ,
+    barrier
+  };
+  constexpr static cl_uint npos = static_cast< cl_uint >( -1 );
+
+  struct instr_t
+  {
+    op_t op;
+    cl_bool block;
+    // value slots; meaning depends on op
+    cl_uint mem[2];
+    cl_uint value;
+    // kernel argument index for set_arg , ndrange dimension otherwise
+    cl_uint arg;
+    cl_kernel kernel;
+    // buffer ops: offset[0] src/buffer offset , offset[1] dst offset , size[0] bytes
+    size_t offset[3];
+    size_t size[3];
+    size_t local[3];
+    cl_uint deps_begin;
+    cl_uint deps_count;
+    cl_uint node;
+    bool event;
+  };
+  struct slot_t
+  {
+    size_t offset;
+    size_t size;
+  };
+
+  std::vector< instr_t > instrs_;
+  std::vector< cl_uint > deps_;
+  std::vector< unsigned char > data_;
+  std::vector< slot_t > slots_;
+  std::vector< Kernel > kernels_;
+  // instruction index of each node
+  std::vector< cl_uint > nodes_;
+  // replay scratch
+  std::vector< cl_event > events_;
+  std::vector< cl_event > wait_;
+  cl_uint max_deps_ = 0;
+
+  cl_uint new_slot_( void const* ptr , size_t size )
+  {
+    const size_t align = alignof( std::max_align_t );
+    const size_t offset = ( data_.size() + align - 1 ) / align * align;
+    data_.resize( offset + size );
+    std::memcpy( data_.data() + offset , ptr , size );
+    slots_.push_back( { offset , size } );
+    return static_cast< cl_uint >( slots_.size() - 1 );
+  }
+  template < typename T >
+  cl_uint resolve_( Value< T > const& v )
+  {
+    return v.is_slot_ ? v.slot_ : new_slot_( &v.value_ , sizeof(T) );
+  }
+  void const* slot_ptr_( cl_uint slot ) const
+  {
+    return data_.data() + slots_[ slot ].offset;
+  }
+  template < typename T >
+  T slot_value_( cl_uint slot ) const
+  {
+    T ret;
+    std::memcpy( &ret , slot_ptr_( slot ) , sizeof(T) );
+    return ret;
+  }
+
+  instr_t make_instr_( op_t op )
+  {
+    instr_t ret;
+    std::memset( &ret , 0 , sizeof(ret) );
+    ret.op = op;
+    ret.mem[0] = ret.mem[1] = ret.value = npos;
+    ret.node = npos;
+    return ret;
+  }
+  Node push_node_( instr_t instr , std::initializer_list< Node > deps )
+  {
+    instr.deps_begin = static_cast< cl_uint >( deps_.size() );
+    instr.deps_count = static_cast< cl_uint >( deps.size() );
+    for( Node d : deps )
+    {
+      deps_.push_back( d.index );
+      instrs_[ nodes_[ d.index ] ].event = true;
+    }
+    if( instr.deps_count > max_deps_ )
+    {
+      max_deps_ = instr.deps_count;
+    }
+    instr.node = static_cast< cl_uint >( nodes_.size() );
+    nodes_.push_back( static_cast< cl_uint >( instrs_.size() ) );
+    instrs_.push_back( instr );
+    return { instr.node };
+  }
+
+public:
+  CommandGraph()
+  {
+  }
+  CommandGraph( size_t reserve_commands )
+  {
+    reserve( reserve_commands );
+  }
+
+  void reserve( size_t commands )
+  {
+    instrs_.reserve( commands );
+    nodes_.reserve( commands );
+    deps_.reserve( commands );
+  }
+  void clear()
+  {
+    instrs_.clear();
+    deps_.clear();
+    data_.clear();
+    slots_.clear();
+    kernels_.clear();
+    nodes_.clear();
+    max_deps_ = 0;
+  }
+  size_t size() const
+  {
+    return nodes_.size();
+  }
+
+  // patchable values
+  template < typename T >
+  Slot< T > slot( T const& initial )
+  {
+    static_assert( std::is_trivially_copyable< T >::value , "slot values must be trivially copyable" );
+    return { new_slot_( &initial , sizeof(T) ) };
+  }
+  template < typename T >
+  void set( Slot< T > slot , T const& value )
+  {
+    std::memcpy( data_.data() + slots_[ slot.index ].offset , &value , sizeof(T) );
+  }
+  template < typename T >
+  T get( Slot< T > slot ) const
+  {
+    return slot_value_< T >( slot.index );
+  }
+
+  // recording
+  template < typename T >
+  std::enable_if_t< !std::is_base_of< Memory , T >::value >
+  set_arg( cl_kernel kernel , cl_uint index , T const& value )
+  {
+    static_assert( std::is_trivially_copyable< T >::value , "kernel arguments must be trivially copyable" );
+    instr_t instr = make_instr_( op_t::set_arg );
+    instr.kernel = kernel;
+    instr.arg = index;
+    instr.value = new_slot_( &value , sizeof(T) );
+    kernels_.emplace_back( kernel );
+    instrs_.push_back( instr );
+  }
+  void set_arg( cl_kernel kernel , cl_uint index , Memory const& mem )
+  {
+    set_arg( kernel , index , mem.get() );
+  }
+  template < typename T >
+  void set_arg( cl_kernel kernel , cl_uint index , Slot< T > slot )
+  {
+    instr_t instr = make_instr_( op_t::set_arg );
+    instr.kernel = kernel;
+    instr.arg = index;
+    instr.value = slot.index;
+    kernels_.emplace_back( kernel );
+    instrs_.push_back( instr );
+  }
+
+  Node write_buffer( Value< cl_mem > buffer , cl_bool block ,
+      size_t offset , size_t size , Value< void const* > ptr ,
+      std::initializer_list< Node > deps={} )
+  {
+    instr_t instr = make_instr_( op_t::write_buffer );
+    instr.mem[0] = resolve_( buffer );
+    instr.value = resolve_( ptr );
+    instr.block = block;
+    instr.offset[0] = offset;
+    instr.size[0] = size;
+    return push_node_( instr , deps );
+  }
+  Node read_buffer( Value< cl_mem > buffer , cl_bool block ,
+      size_t offset , size_t size , Value< void* > ptr ,
+      std::initializer_list< Node > deps={} )
+  {
+    instr_t instr = make_instr_( op_t::read_buffer );
+    instr.mem[0] = resolve_( buffer );
+    instr.value = resolve_( ptr );
+    instr.block = block;
+    instr.offset[0] = offset;
+    instr.size[0] = size;
+    return push_node_( instr , deps );
+  }
+  Node copy_buffer( Value< cl_mem > src , Value< cl_mem > dst ,
+      size_t src_offset , size_t dst_offset , size_t size ,
+      std::initializer_list< Node > deps={} )
+  {
+    instr_t instr = make_instr_( op_t::copy_buffer );
+    instr.mem[0] = resolve_( src );
+    instr.mem[1] = resolve_( dst );
+    instr.offset[0] = src_offset;
+    instr.offset[1] = dst_offset;
+    instr.size[0] = size;
+    return push_node_( instr , deps );
+  }
+  template < typename T >
+  Node fill_buffer( Value< cl_mem > buffer ,
+      T const& pattern ,
+      size_t offsetbytes , size_t count ,
+      std::initializer_list< Node > deps={} )
+  {
+    instr_t instr = make_instr_( op_t::fill_buffer );
+    instr.mem[0] = resolve_( buffer );
+    instr.value = new_slot_( &pattern , sizeof(T) );
+    instr.offset[0] = offsetbytes;
+    instr.size[0] = sizeof(T)*count;
+    return push_node_( instr , deps );
+  }
+  Node ndrange( cl_kernel kernel ,
+      NDRange const& global_offsets ,
+      NDRange const& global_size ,
+      NDRange const& local_size ,
+      std::initializer_list< Node > deps={} )
+  {
+#ifndef NDEBUG
+    if( global_offsets.dim() != global_size.dim() ||
+        global_size.dim() != local_size.dim() )
+    {
+#ifdef EC_THROW_EXCEPTION
+      throw std::runtime_error( "ndrange dimension different" );
+#endif
+    }
+#endif
+    instr_t instr = make_instr_( op_t::ndrange );
+    instr.kernel = kernel;
+    instr.arg = global_size.dim();
+    for( cl_uint i=0; i<global_size.dim(); ++i )
+    {
+      instr.offset[i] = global_offsets.dim() ? global_offsets.data()[i] : 0;
+      instr.size[i] = global_size.data()[i];
+      instr.local[i] = local_size.dim() ? local_size.data()[i] : 0;
+    }
+    kernels_.emplace_back( kernel );
+    return push_node_( instr , deps );
+  }
+  Node barrier( std::initializer_list< Node > deps={} )
+  {
+    return push_node_( make_instr_( op_t::barrier ) , deps );
+  }
+
+  // enqueue the whole graph. events in the wait list gate every command
+  // without recorded dependencies. returns the event of the last command.
+  Event replay( CommandQueue const& queue ,
+      detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr )
+  {
+    events_.assign( nodes_.size() , NULL );
+    wait_.resize( max_deps_ > events.size() ? max_deps_ : events.size() );
+    const cl_command_queue q = queue.get();
+    int err = CL_SUCCESS;
+    for( size_t i=0; i<instrs_.size() && err == CL_SUCCESS; ++i )
+    {
+      instr_t const& in = instrs_[i];
+      if( in.op == op_t::set_arg )
+      {
+        err = clSetKernelArg( in.kernel , in.arg ,
+            slots_[ in.value ].size , slot_ptr_( in.value ) );
+        continue;
+      }
+
+      cl_uint nwait;
+      cl_event const* wait;
+      if( in.deps_count == 0 )
+      {
+        nwait = events.size();
+        wait = events.data();
+      }
+      else
+      {
+        for( cl_uint d=0; d<in.deps_count; ++d )
+        {
+          wait_[d] = events_[ deps_[ in.deps_begin + d ] ];
+        }
+        nwait = in.deps_count;
+        wait = wait_.data();
+      }
+      const bool last = in.node + 1 == nodes_.size();
+      cl_event* ev = ( in.event || last ) ? &events_[ in.node ] : nullptr;
+
+      switch( in.op )
+      {
+        case op_t::write_buffer:
+          err = clEnqueueWriteBuffer( q , slot_value_< cl_mem >( in.mem[0] ) , in.block ,
+              in.offset[0] , in.size[0] , slot_value_< void const* >( in.value ) ,
+              nwait , wait , ev );
+          break;
+        case op_t::read_buffer:
+          err = clEnqueueReadBuffer( q , slot_value_< cl_mem >( in.mem[0] ) , in.block ,
+              in.offset[0] , in.size[0] , slot_value_< void* >( in.value ) ,
+              nwait , wait , ev );
+          break;
+        case op_t::copy_buffer:
+          err = clEnqueueCopyBuffer( q ,
+              slot_value_< cl_mem >( in.mem[0] ) , slot_value_< cl_mem >( in.mem[1] ) ,
+              in.offset[0] , in.offset[1] , in.size[0] ,
+              nwait , wait , ev );
+          break;
+        case op_t::fill_buffer:
+          err = clEnqueueFillBuffer( q , slot_value_< cl_mem >( in.mem[0] ) ,
+              slot_ptr_( in.value ) , slots_[ in.value ].size ,
+              in.offset[0] , in.size[0] ,
+              nwait , wait , ev );
+          break;
+        case op_t::ndrange:
+          err = clEnqueueNDRangeKernel( q , in.kernel , in.arg ,
+              in.offset , in.size , in.local[0] ? in.local : nullptr ,
+              nwait , wait , ev );
+          break;
+        case op_t::barrier:
+          err = clEnqueueBarrierWithWaitList( q , nwait , wait , ev );
+          break;
+        case op_t::set_arg:
+          break;
+      }
+    }
+
+    cl_event ret = NULL;
+    if( err == CL_SUCCESS && !events_.empty() )
+    {
+      ret = events_.back();
+      events_.back() = NULL;
+    }
+    for( cl_event e : events_ )
+    {
+      if( e != NULL )
+      {
+        clReleaseEvent( e );
+      }
+    }
+    EC_CHECK_ERROR( err , errp , return {} )
+    EC_SET_ERRP( errp )
+    return detail::make_system_event( ret );
+  }
+};
+
+}
@@ -499,13 +499,366 @@ public:
     return detail::make_system_event( ev );
   }
 
+  // fire-and-forget overloads.
+  // nullptr is passed as the event out-parameter ,
+  // so the driver does not allocate or track an event for the command.
+  void barrier( no_event_t ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueBarrierWithWaitList( get() ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void read_buffer( no_event_t ,
+      cl_mem buffer , cl_bool block ,
+      size_t offset , size_t size , void* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueReadBuffer( get() , buffer , block ,
+        offset , size , ptr ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void write_buffer( no_event_t ,
+      cl_mem buffer , cl_bool block ,
+      size_t offset , size_t size , void const* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueWriteBuffer( get() , buffer , block ,
+        offset , size , ptr ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void copy_buffer( no_event_t ,
+      cl_mem src , cl_mem dst ,
+      size_t src_offset , size_t dst_offset ,
+      size_t size ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueCopyBuffer( get() , src , dst ,
+        src_offset , dst_offset , size ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void fill_buffer( no_event_t ,
+      cl_mem buffer ,
+      void const* pattern , size_t pattern_size ,
+      size_t offset , size_t bytes ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+#ifndef NDEBUG
+    if( (bytes % pattern_size) != 0 )
+    {
+#ifdef EC_THROW_EXCEPTION
+      throw std::runtime_error( "bytes must be times of pattern_size" );
+#endif
+    }
+#endif
+    const int err = clEnqueueFillBuffer( get() , buffer ,
+        pattern , pattern_size , offset , bytes ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  template < typename T >
+  void fill_buffer( no_event_t ,
+      cl_mem buffer ,
+      T const& pattern ,
+      size_t offsetbytes , size_t count ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    fill_buffer( no_event , buffer ,
+        &pattern , sizeof(T) ,
+        offsetbytes , sizeof(T)*count ,
+        events , errp );
+  }
+  template < typename T = void >
+  T*
+  map_buffer( no_event_t ,
+      cl_mem buffer ,
+      cl_bool block , cl_map_flags flags ,
+      size_t offset , size_t size ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    int err;
+    void* ret = clEnqueueMapBuffer( get() , buffer , block , flags ,
+        offset , size ,
+        events.size() , events.data() ,
+        nullptr , &err );
+    EC_CHECK_ERROR( err , errp , return nullptr )
+    EC_SET_ERRP( errp )
+    return reinterpret_cast< T* >( ret );
+  }
+  void unmap( no_event_t ,
+      cl_mem mem ,
+      void* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueUnmapMemObject( get() , mem , ptr ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void read_buffer_rect( no_event_t ,
+      cl_mem buffer , cl_bool block ,
+      ImageOffset const& buffer_offset , ImageOffset const& host_offset ,
+      ImageSize const& size ,
+      ImagePitch const& buffer_pitch , ImagePitch const& host_pitch ,
+      void* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueReadBufferRect( get() , buffer , block ,
+        buffer_offset.data() , host_offset.data() ,
+        size.data() ,
+        buffer_pitch.row() , buffer_pitch.slice() ,
+        host_pitch.row() , host_pitch.slice() ,
+        ptr ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void write_buffer_rect( no_event_t ,
+      cl_mem buffer , cl_bool block ,
+      ImageOffset const& buffer_offset , ImageOffset const& host_offset ,
+      ImageSize const& size ,
+      ImagePitch const& buffer_pitch , ImagePitch const& host_pitch ,
+      void const* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueWriteBufferRect( get() , buffer , block ,
+        buffer_offset.data() , host_offset.data() ,
+        size.data() ,
+        buffer_pitch.row() , buffer_pitch.slice() ,
+        host_pitch.row() , host_pitch.slice() ,
+        ptr ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void copy_buffer_rect( no_event_t ,
+      cl_mem src , cl_mem dst ,
+      ImageOffset const& src_offset , ImageOffset const& dst_offset ,
+      ImageSize const& size ,
+      ImagePitch const& src_pitch , ImagePitch const& dst_pitch ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueCopyBufferRect( get() ,
+        src , dst ,
+        src_offset.data() , dst_offset.data() ,
+        size.data() ,
+        src_pitch.row() , src_pitch.slice() ,
+        dst_pitch.row() , dst_pitch.slice() ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void read_image( no_event_t ,
+      cl_mem image , cl_bool block ,
+      ImageOffset const& offset , ImageSize const& size ,
+      ImagePitch const& pitch ,
+      void* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueReadImage( get() , image , block ,
+        offset.data() , size.data() , pitch.row() , pitch.slice() ,
+        ptr ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void write_image( no_event_t ,
+      cl_mem image , cl_bool block ,
+      ImageOffset const& offset , ImageSize const& size ,
+      ImagePitch const& pitch ,
+      void const* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueWriteImage( get() , image , block ,
+        offset.data() , size.data() , pitch.row() , pitch.slice() ,
+        ptr ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void copy_image( no_event_t ,
+      cl_mem src , cl_mem dst ,
+      ImageOffset const& src_offset , ImageOffset const& dst_offset ,
+      ImageSize const& size ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueCopyImage( get() , src , dst ,
+        src_offset.data() , dst_offset.data() ,
+        size.data() ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void fill_image( no_event_t ,
+      cl_mem image ,
+      void const* color ,
+      ImageOffset const& offset , ImageSize const& size ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueFillImage( get() , image ,
+        color , offset.data() , size.data() ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void copy_image_to_buffer( no_event_t ,
+      cl_mem image , cl_mem buffer ,
+      ImageOffset const& image_offset , ImageSize const& image_size ,
+      size_t buffer_offset ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueCopyImageToBuffer( get() ,
+        image , buffer ,
+        image_offset.data() , image_size.data() , buffer_offset ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void copy_buffer_to_image( no_event_t ,
+      cl_mem buffer , cl_mem image ,
+      size_t buffer_offset ,
+      ImageOffset const& image_offset , ImageSize const& image_size ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueCopyBufferToImage( get() ,
+        buffer , image ,
+        buffer_offset , image_offset.data() , image_size.data() ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  template < typename T = void >
+  T*
+  map_image( no_event_t ,
+      cl_mem image ,
+      cl_bool block , cl_map_flags flags ,
+      ImageOffset const& offset , ImageSize const& size ,
+      ImagePitch& host_pitch ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    int err;
+    void* ret = clEnqueueMapImage( get() , image , block , flags ,
+        offset.data() , size.data() ,
+        host_pitch.data_ , host_pitch.data_ + 1 ,
+        events.size() , events.data() ,
+        nullptr , &err );
+    EC_CHECK_ERROR( err , errp , return nullptr )
+    EC_SET_ERRP( errp )
+    return reinterpret_cast< T* >( ret );
+  }
+  void ndrange( no_event_t ,
+      cl_kernel kernel ,
+      NDRange const& global_offsets ,
+      NDRange const& global_size ,
+      NDRange const& local_size ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+#ifndef NDEBUG
+    if( global_offsets.dim() != global_size.dim() ||
+        global_size.dim() != local_size.dim() )
+    {
+#ifdef EC_THROW_EXCEPTION
+      throw std::runtime_error( "ndrange dimension different" );
+#endif
+    }
+#endif
+    const int err = clEnqueueNDRangeKernel( get() , kernel ,
+        global_offsets.dim() ,
+        global_offsets.data() , global_size.data() , local_size.data() ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  void task( no_event_t ,
+      cl_kernel kernel ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const int err = clEnqueueTask( get() , kernel ,
+        events.size() , events.data() ,
+        nullptr );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+
+  // transfers staged through the pinned buffers of pool; see staging.hpp.
+  // ptr may be reused as soon as upload() returns
+  Event upload( StagingPool& pool , cl_mem buffer ,
+      size_t offset , size_t size , void const* ptr ,
+      detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr ) const;
+  // blocks until ptr is filled
+  void download( StagingPool& pool , cl_mem buffer ,
+      size_t offset , size_t size , void* ptr ,
+      detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr ) const;
+
+  // transfers through the method measured fastest on this queue's device
+  // for the size; see transfer.hpp. ptr must stay valid until the returned
+  // event completed
+  Event transfer_to_device( cl_mem buffer ,
+      size_t offset , size_t size , void const* ptr ,
+      detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr ) const;
+  // blocks until ptr is filled
+  void transfer_to_host( cl_mem buffer ,
+      size_t offset , size_t size , void* ptr ,
+      detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr ) const;
+
+  // both also hand events released on this thread back to the driver
   void finish() const
   {
     clFinish( get() );
+    detail::EventReleaseList::drain_local();
   }
   void flush() const
   {
     clFlush( get() );
+    detail::EventReleaseList::drain_local();
   }
 
 
@@ -0,0 +1,294 @@
+#pragma once
+
+// completion notifications through a pollable file descriptor;
+// eventfd on linux , a non-blocking pipe on other POSIX systems.
+#if defined(__linux__) || defined(__APPLE__) || defined(__unix__)
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "event.hpp"
+#include "wait.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+namespace ec
+{
+
+// multiplexes any number of in-flight commands onto one file descriptor.
+// watch() registers a completion callback; the callback pushes the token
+// onto a lock-free MPSC queue and signals fd() once per batch.
+// the reactor polls fd() for readability and calls drain().
+// watch() and drain() belong to the reactor thread; callbacks may fire on any.
+class CompletionChannel
+{
+protected:
+  struct node_t
+  {
+    std::atomic< node_t* > next;
+    node_t* free_next;
+    CompletionChannel* channel;
+    void* token;
+    cl_int status;
+  };
+
+  // Vyukov's intrusive MPSC queue; producers only touch head_
+  std::atomic< node_t* > head_;
+  node_t* tail_;
+  node_t stub_;
+
+  std::atomic< bool > signalled_;
+  // callbacks registered and not yet returned; a drained node's callback
+  // may still be in signal_()
+  std::atomic< size_t > callbacks_;
+  node_t* free_ = nullptr;
+  size_t pending_ = 0;
+  int read_fd_ = -1;
+  int write_fd_ = -1;
+
+  void push_( node_t* n )
+  {
+    n->next.store( nullptr , std::memory_order_relaxed );
+    node_t* prev = head_.exchange( n , std::memory_order_acq_rel );
+    prev->next.store( n , std::memory_order_release );
+  }
+  // nullptr if empty , or if a producer is halfway through push_;
+  // that producer signals afterwards , so nothing is lost
+  node_t* pop_()
+  {
+    node_t* tail = tail_;
+    node_t* next = tail->next.load( std::memory_order_acquire );
+    if( tail == &stub_ )
+    {
+      if( next == nullptr )
+      {
+        return nullptr;
+      }
+      tail_ = next;
+      tail = next;
+      next = next->next.load( std::memory_order_acquire );
+    }
+    if( next )
+    {
+      tail_ = next;
+      return tail;
+    }
+    if( tail != head_.load( std::memory_order_acquire ) )
+    {
+      return nullptr;
+    }
+    push_( &stub_ );
+    next = tail->next.load( std::memory_order_acquire );
+    if( next )
+    {
+      tail_ = next;
+      return tail;
+    }
+    return nullptr;
+  }
+
+  void signal_()
+  {
+    if( signalled_.exchange( true ) )
+    {
+      return;
+    }
+#if defined(__linux__)
+    const uint64_t one = 1;
+    ssize_t r = ::write( write_fd_ , &one , sizeof(one) );
+#else
+    const char one = 1;
+    ssize_t r = ::write( write_fd_ , &one , sizeof(one) );
+#endif
+    (void)r;
+  }
+  void clear_()
+  {
+    signalled_.store( false );
+#if defined(__linux__)
+    uint64_t value;
+    ssize_t r = ::read( read_fd_ , &value , sizeof(value) );
+    (void)r;
+#else
+    char buf[64];
+    while( ::read( read_fd_ , buf , sizeof(buf) ) > 0 )
+    {
+    }
+#endif
+  }
+
+  static void callback_( cl_event , cl_int status , void* userdata )
+  {
+    node_t* n = static_cast< node_t* >( userdata );
+    n->status = status;
+    CompletionChannel* self = n->channel;
+    self->push_( n );
+    self->signal_();
+    // last touch of self
+    self->callbacks_.fetch_sub( 1 , std::memory_order_release );
+  }
+
+  node_t* acquire_node_()
+  {
+    node_t* n = free_;
+    if( n )
+    {
+      free_ = n->free_next;
+      return n;
+    }
+    return new node_t;
+  }
+  void recycle_( node_t* n )
+  {
+    n->free_next = free_;
+    free_ = n;
+  }
+
+  void close_()
+  {
+    if( read_fd_ != -1 )
+    {
+      ::close( read_fd_ );
+    }
+    if( write_fd_ != -1 && write_fd_ != read_fd_ )
+    {
+      ::close( write_fd_ );
+    }
+    read_fd_ = write_fd_ = -1;
+  }
+
+public:
+  explicit CompletionChannel( int* errp=nullptr )
+    : head_( &stub_ ) ,
+      tail_( &stub_ ) ,
+      signalled_( false ) ,
+      callbacks_( 0 )
+  {
+    stub_.next.store( nullptr );
+    int err = CL_SUCCESS;
+#if defined(__linux__)
+    read_fd_ = write_fd_ = ::eventfd( 0 , EFD_NONBLOCK | EFD_CLOEXEC );
+    if( read_fd_ == -1 )
+    {
+      err = CL_OUT_OF_RESOURCES;
+    }
+#else
+    int fds[2];
+    if( ::pipe( fds ) == -1 )
+    {
+      err = CL_OUT_OF_RESOURCES;
+    }
+    else
+    {
+      read_fd_ = fds[0];
+      write_fd_ = fds[1];
+      for( int fd : fds )
+      {
+        ::fcntl( fd , F_SETFL , ::fcntl( fd , F_GETFL ) | O_NONBLOCK );
+        ::fcntl( fd , F_SETFD , FD_CLOEXEC );
+      }
+    }
+#endif
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  CompletionChannel( CompletionChannel const& ) = delete;
+  CompletionChannel& operator=( CompletionChannel const& ) = delete;
+
+  // waits for every watched command and for its callback to return ,
+  // dropping undrained completions
+  ~CompletionChannel()
+  {
+    while( pending_ > 0 )
+    {
+      pollfd p = { read_fd_ , POLLIN , 0 };
+      ::poll( &p , 1 , -1 );
+      drain( []( void* , cl_int ){} );
+    }
+    while( callbacks_.load( std::memory_order_acquire ) != 0 )
+    {
+      std::this_thread::yield();
+    }
+    while( free_ )
+    {
+      node_t* n = free_;
+      free_ = n->free_next;
+      delete n;
+    }
+    close_();
+  }
+
+  // readable while completions are waiting in drain()
+  int fd() const
+  {
+    return read_fd_;
+  }
+  // watched commands not drained yet
+  size_t pending() const
+  {
+    return pending_;
+  }
+
+  // token comes back from drain() once event completes or fails.
+  // flushes the event's queue , or the destructor could wait forever
+  void watch( cl_event event , void* token , int* errp=nullptr )
+  {
+    node_t* n = acquire_node_();
+    n->channel = this;
+    n->token = token;
+    ++pending_;
+    callbacks_.fetch_add( 1 , std::memory_order_relaxed );
+    detail::flush_queues_( event );
+    const int err = clSetEventCallback( event , CL_COMPLETE , callback_ , n );
+    if( err != CL_SUCCESS )
+    {
+      --pending_;
+      callbacks_.fetch_sub( 1 , std::memory_order_relaxed );
+      recycle_( n );
+    }
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+
+  // calls func( token , execution_status ) for up to max completions;
+  // returns how many were handed out
+  template < typename F >
+  size_t drain( F&& func , size_t max=SIZE_MAX )
+  {
+    clear_();
+    size_t ret = 0;
+    while( ret < max )
+    {
+      node_t* n = pop_();
+      if( n == nullptr )
+      {
+        break;
+      }
+      void* token = n->token;
+      const cl_int status = n->status;
+      recycle_( n );
+      --pending_;
+      ++ret;
+      func( token , status );
+    }
+    if( ret == max )
+    {
+      // more may be left; keep fd() readable
+      signal_();
+    }
+    return ret;
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,288 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "event.hpp"
+#include "wait.hpp"
+#include "list_view.hpp"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ec { namespace detail
+{
+
+// fixed-size blocks for callback state.
+// continuations whose state fits in a block never touch the heap;
+// blocks are carved from chunks and recycled through a free list.
+class CallbackSlab
+{
+public:
+  constexpr static size_t block_size = 64;
+  constexpr static size_t chunk_blocks = 256;
+
+protected:
+  union block_t
+  {
+    block_t* next;
+    alignas( std::max_align_t ) unsigned char data[ block_size ];
+  };
+
+  std::mutex mutex_;
+  block_t* free_ = nullptr;
+  std::vector< std::unique_ptr< block_t[] > > chunks_;
+
+public:
+  template < typename T >
+  constexpr static bool fits()
+  {
+    return sizeof(T) <= block_size && alignof(T) <= alignof(std::max_align_t);
+  }
+
+  void* allocate()
+  {
+    std::lock_guard< std::mutex > lock( mutex_ );
+    if( free_ == nullptr )
+    {
+      std::unique_ptr< block_t[] > chunk( new block_t[ chunk_blocks ] );
+      for( size_t i=0; i<chunk_blocks; ++i )
+      {
+        chunk[i].next = free_;
+        free_ = &chunk[i];
+      }
+      chunks_.push_back( std::move( chunk ) );
+    }
+    block_t* ret = free_;
+    free_ = ret->next;
+    return ret;
+  }
+  void deallocate( void* ptr )
+  {
+    block_t* b = static_cast< block_t* >( ptr );
+    std::lock_guard< std::mutex > lock( mutex_ );
+    b->next = free_;
+    free_ = b;
+  }
+
+  static CallbackSlab& instance()
+  {
+    static CallbackSlab slab;
+    return slab;
+  }
+};
+
+template < typename T , typename... Args >
+T* slab_new( Args&&... args )
+{
+  void* p = CallbackSlab::fits< T >() ?
+    CallbackSlab::instance().allocate() : ::operator new( sizeof(T) );
+  try
+  {
+    return new( p ) T( std::forward< Args >( args )... );
+  }
+  catch( ... )
+  {
+    if( CallbackSlab::fits< T >() ) { CallbackSlab::instance().deallocate( p ); }
+    else { ::operator delete( p ); }
+    throw;
+  }
+}
+template < typename T >
+void slab_delete( T* ptr )
+{
+  ptr->~T();
+  if( CallbackSlab::fits< T >() ) { CallbackSlab::instance().deallocate( ptr ); }
+  else { ::operator delete( ptr ); }
+}
+
+// new user event in the context of event
+inline UniqueEvent make_user_event_for( cl_event event , int* errp )
+{
+  cl_context context;
+  int err = clGetEventInfo( event , CL_EVENT_CONTEXT , sizeof(context) , &context , nullptr );
+  EC_CHECK_ERROR( err , errp , return {} )
+  return UniqueEvent( context , errp );
+}
+
+template < typename F >
+struct then_node
+{
+  F func;
+  cl_event result;
+
+  template < typename F_ >
+  then_node( F_&& f , cl_event r )
+    : func( std::forward< F_ >( f ) ) ,
+      result( r )
+  {
+  }
+
+  static void callback( cl_event , cl_int status , void* userdata )
+  {
+    then_node* self = static_cast< then_node* >( userdata );
+    cl_int ret = status < 0 ? status : CL_COMPLETE;
+    if( ret == CL_COMPLETE )
+    {
+      try
+      {
+        self->func();
+      }
+      catch( exception const& e )
+      {
+        ret = e.error_code() < 0 ? e.error_code() : CL_INVALID_OPERATION;
+      }
+      catch( ... )
+      {
+        ret = CL_INVALID_OPERATION;
+      }
+    }
+    const cl_event result = self->result;
+    slab_delete( self );
+    clSetUserEventStatus( result , ret );
+    clReleaseEvent( result );
+  }
+};
+
+// shared by every callback of one when_all / when_any
+struct join_node
+{
+  std::atomic< cl_uint > remaining;
+  std::atomic< cl_int > status;
+  std::atomic< bool > signalled;
+  cl_event result;
+  bool any;
+
+  join_node( cl_uint count , cl_event r , bool a )
+    : remaining( count ) ,
+      status( CL_COMPLETE ) ,
+      signalled( false ) ,
+      result( r ) ,
+      any( a )
+  {
+  }
+
+  void signal_( cl_int s )
+  {
+    if( !signalled.exchange( true ) )
+    {
+      clSetUserEventStatus( result , s );
+    }
+  }
+  static void callback( cl_event , cl_int status , void* userdata )
+  {
+    join_node* self = static_cast< join_node* >( userdata );
+    if( status < 0 )
+    {
+      cl_int expected = CL_COMPLETE;
+      self->status.compare_exchange_strong( expected , status );
+    }
+    if( self->any && status == CL_COMPLETE )
+    {
+      self->signal_( CL_COMPLETE );
+    }
+    if( self->remaining.fetch_sub( 1 ) == 1 )
+    {
+      // all inputs done: when_all completes here , and when_any
+      // reports failure only if every input failed
+      self->signal_( self->status.load() );
+      const cl_event result = self->result;
+      slab_delete( self );
+      clReleaseEvent( result );
+    }
+  }
+};
+
+inline UniqueEvent join_( list_view<cl_event> const& events , bool any , int* errp )
+{
+  if( events.size() == 0 )
+  {
+    EC_SET_ERRP( errp )
+    return {};
+  }
+  UniqueEvent ret = make_user_event_for( events.data()[0] , errp );
+  if( !ret )
+  {
+    return {};
+  }
+  join_node* node = slab_new< join_node >( events.size() , ret.get() , any );
+  // one reference for the callbacks , released by the last one
+  ret.retain_if();
+  // callbacks alone never submit the inputs
+  flush_queues_( events );
+  for( size_type i=0; i<events.size(); ++i )
+  {
+    const int err = clSetEventCallback( events.data()[i] , CL_COMPLETE ,
+        join_node::callback , node );
+    if( err != CL_SUCCESS )
+    {
+      // count the failed registration as a failed input
+      join_node::callback( events.data()[i] , err , node );
+    }
+  }
+  EC_SET_ERRP( errp )
+  return ret;
+}
+
+template < typename F >
+UniqueEvent EventBase::then( F&& func , int* errp ) const
+{
+  using node_t = then_node< std::decay_t< F > >;
+  UniqueEvent ret = make_user_event_for( get() , errp );
+  if( !ret )
+  {
+    return {};
+  }
+  node_t* node = slab_new< node_t >( std::forward< F >( func ) , ret.get() );
+  // released by the callback
+  ret.retain_if();
+  // callbacks alone never submit the command
+  flush_queues_( get() );
+  const int err = clSetEventCallback( get() , CL_COMPLETE , node_t::callback , node );
+  if( err != CL_SUCCESS )
+  {
+    slab_delete( node );
+    ret.release_if();
+  }
+  EC_CHECK_ERROR( err , errp , return {} )
+  EC_SET_ERRP( errp )
+  return ret;
+}
+
+}}
+
+namespace ec
+{
+
+// user event completing once every input completed.
+// fails with the first negative status among the inputs.
+inline Event when_all( detail::list_view<cl_event> const& events , int* errp=nullptr )
+{
+  return detail::join_( events , false , errp );
+}
+// user event completing as soon as one input completed successfully.
+// fails only if every input failed.
+inline Event when_any( detail::list_view<cl_event> const& events , int* errp=nullptr )
+{
+  return detail::join_( events , true , errp );
+}
+template < typename E0 , typename E1 , typename... Es >
+auto when_all( E0 const& e0 , E1 const& e1 , Es const&... es )
+  -> decltype( e0.get() , e1.get() , Event() )
+{
+  const cl_event events[] = { e0.get() , e1.get() , es.get()... };
+  return when_all( events );
+}
+template < typename E0 , typename E1 , typename... Es >
+auto when_any( E0 const& e0 , E1 const& e1 , Es const&... es )
+  -> decltype( e0.get() , e1.get() , Event() )
+{
+  const cl_event events[] = { e0.get() , e1.get() , es.get()... };
+  return when_any( events );
+}
+
+}
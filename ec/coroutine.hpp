@@ -0,0 +1,250 @@
+#pragma once
+
+// C++20 coroutine support; empty when compiled as an earlier standard.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "event.hpp"
+#include "wait.hpp"
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+namespace ec
+{
+
+// type-erased reference to anything with post( std::coroutine_handle<> ).
+// a null ExecutorRef stands for default_executor().
+class ExecutorRef
+{
+  void* self_;
+  void (*post_)( void* , std::coroutine_handle<> );
+
+public:
+  constexpr ExecutorRef()
+    : self_( nullptr ) ,
+      post_( nullptr )
+  {
+  }
+  template < typename Executor ,
+    typename = std::enable_if_t< !std::is_same< Executor , ExecutorRef >::value > >
+  ExecutorRef( Executor& executor )
+    : self_( &executor ) ,
+      post_( []( void* self , std::coroutine_handle<> h )
+          {
+            static_cast< Executor* >( self )->post( h );
+          } )
+  {
+  }
+  void post( std::coroutine_handle<> h ) const
+  {
+    post_( self_ , h );
+  }
+  explicit operator bool() const
+  {
+    return post_ != nullptr;
+  }
+};
+
+// minimal run-loop executor: any number of threads may call run()
+class RunLoopExecutor
+{
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque< std::coroutine_handle<> > handles_;
+  bool stopped_ = false;
+
+public:
+  void post( std::coroutine_handle<> h )
+  {
+    {
+      std::lock_guard< std::mutex > lock( mutex_ );
+      handles_.push_back( h );
+    }
+    cv_.notify_one();
+  }
+  // resumes one coroutine; false once stopped and drained
+  bool run_one()
+  {
+    std::coroutine_handle<> h;
+    {
+      std::unique_lock< std::mutex > lock( mutex_ );
+      cv_.wait( lock , [this]{ return stopped_ || !handles_.empty(); } );
+      if( handles_.empty() )
+      {
+        return false;
+      }
+      h = handles_.front();
+      handles_.pop_front();
+    }
+    h.resume();
+    return true;
+  }
+  void run()
+  {
+    while( run_one() )
+    {
+    }
+  }
+  void stop()
+  {
+    {
+      std::lock_guard< std::mutex > lock( mutex_ );
+      stopped_ = true;
+    }
+    cv_.notify_all();
+  }
+};
+
+// resumes on the OpenCL callback thread itself. opt-in only: the coroutine
+// then runs inside the driver's callback , where a blocking call or a long
+// computation stalls the runtime and may deadlock it
+class InlineExecutor
+{
+public:
+  void post( std::coroutine_handle<> h )
+  {
+    h.resume();
+  }
+};
+inline ExecutorRef inline_executor()
+{
+  static InlineExecutor ret;
+  return ret;
+}
+
+namespace detail
+{
+// one thread owned by the library , started on first use and joined at exit
+class executor_thread_
+{
+  RunLoopExecutor loop_;
+  std::thread thread_;
+
+public:
+  executor_thread_()
+    : thread_( [this]{ loop_.run(); } )
+  {
+  }
+  ~executor_thread_()
+  {
+    loop_.stop();
+    thread_.join();
+  }
+  void post( std::coroutine_handle<> h )
+  {
+    loop_.post( h );
+  }
+};
+inline ExecutorRef executor_thread_instance_()
+{
+  static executor_thread_ ret;
+  return ret;
+}
+
+inline ExecutorRef& default_executor_()
+{
+  static ExecutorRef ret;
+  return ret;
+}
+}
+
+// executor used by a plain co_await on an event; unless set , a thread owned
+// by the library , so coroutines never run on the OpenCL callback thread.
+// set it once at startup , before any event is awaited.
+inline void set_default_executor( ExecutorRef executor )
+{
+  detail::default_executor_() = executor;
+}
+inline ExecutorRef default_executor()
+{
+  const ExecutorRef ret = detail::default_executor_();
+  return ret ? ret : detail::executor_thread_instance_();
+}
+
+// suspends until the event completes , registered through clSetEventCallback;
+// no thread blocks in clWaitForEvents / clFinish.
+// co_await yields the execution status; a negative status throws ec::exception.
+class EventAwaiter
+{
+  cl_event event_;
+  ExecutorRef executor_;
+  std::coroutine_handle<> handle_;
+  cl_int status_;
+
+  static void callback_( cl_event , cl_int status , void* userdata )
+  {
+    EventAwaiter* self = static_cast< EventAwaiter* >( userdata );
+    self->status_ = status;
+    self->executor_.post( self->handle_ );
+  }
+
+public:
+  EventAwaiter( cl_event event , ExecutorRef executor )
+    : event_( event ) ,
+      executor_( executor ? executor : default_executor() ) ,
+      status_( CL_COMPLETE )
+  {
+  }
+
+  bool await_ready()
+  {
+    if( event_ == NULL )
+    {
+      return true;
+    }
+    const int err = clGetEventInfo( event_ , CL_EVENT_COMMAND_EXECUTION_STATUS ,
+        sizeof(status_) , &status_ , nullptr );
+    if( err != CL_SUCCESS )
+    {
+      status_ = err;
+    }
+    return status_ <= CL_COMPLETE;
+  }
+  bool await_suspend( std::coroutine_handle<> h )
+  {
+    handle_ = h;
+    // nothing else may submit the command , the way clWaitForEvents would
+    detail::flush_queues_( event_ );
+    // the callback may resume the coroutine before clSetEventCallback returns
+    const int err = clSetEventCallback( event_ , CL_COMPLETE , callback_ , this );
+    if( err != CL_SUCCESS )
+    {
+      status_ = err;
+      return false;
+    }
+    return true;
+  }
+  cl_int await_resume() const
+  {
+    if( status_ < 0 )
+    {
+      EC_THROW_IF( status_ );
+    }
+    return status_;
+  }
+};
+
+namespace detail
+{
+inline EventAwaiter operator co_await( EventBase const& event )
+{
+  return { event.get() , default_executor() };
+}
+}
+
+// co_await ec::resume_on( queue.read_buffer(...) , executor );
+inline EventAwaiter resume_on( detail::EventBase const& event , ExecutorRef executor )
+{
+  return { event.get() , executor };
+}
+
+}
+
+#endif
+#endif
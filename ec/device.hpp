@@ -202,6 +202,7 @@ EC_DEVICE_INFO_DIRECT( CL_DEVICE_GLOBAL_MEM_CACHE_SIZE , cl_ulong );
 EC_DEVICE_INFO_DIRECT( CL_DEVICE_GLOBAL_MEM_SIZE , cl_ulong );
 EC_DEVICE_INFO_DIRECT( CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE , cl_ulong );
 EC_DEVICE_INFO_DIRECT( CL_DEVICE_MAX_CONSTANT_ARGS , cl_uint );
+EC_DEVICE_INFO_DIRECT( CL_DEVICE_HOST_UNIFIED_MEMORY , cl_bool );
 EC_DEVICE_INFO_DIRECT( CL_DEVICE_ENDIAN_LITTLE , cl_bool );
 EC_DEVICE_INFO_DIRECT( CL_DEVICE_AVAILABLE , cl_bool );
 EC_DEVICE_INFO_DIRECT( CL_DEVICE_COMPILER_AVAILABLE , cl_bool );
@@ -0,0 +1,345 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "definitions.hpp"
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ec
+{
+
+// typed , growable device-resident array bound to one queue.
+// push_back() collects elements on the host; flush() appends them with one
+// write_buffer. growth is geometric , and a reallocation copies the old
+// contents with copy_buffer on the device.
+// every device-side operation flushes pending pushes first , so commands
+// observe elements in push order.
+template < typename T >
+class device_vector
+{
+  static_assert( std::is_trivially_copyable< T >::value ,
+      "device_vector elements are copied bytewise" );
+
+public:
+  using value_type = T;
+  using size_type = size_t;
+
+  // mapped host view of a range; unmapped when destroyed.
+  // the view keeps its buffer alive , but writes through it are lost if the
+  // vector reallocates meanwhile: do not push , flush or reserve while a
+  // view exists
+  class host_view
+  {
+    friend class device_vector;
+
+    CommandQueue queue_;
+    Buffer buffer_;
+    T* data_;
+    size_t size_;
+
+    host_view( CommandQueue queue , Buffer buffer , T* data , size_t size )
+      : queue_( std::move( queue ) ) ,
+        buffer_( std::move( buffer ) ) ,
+        data_( data ) ,
+        size_( size )
+    {
+    }
+
+  public:
+    using iterator = T*;
+    using const_iterator = T const*;
+
+    host_view( host_view const& ) = delete;
+    host_view& operator=( host_view const& ) = delete;
+    host_view( host_view&& rhs )
+      : queue_( std::move( rhs.queue_ ) ) ,
+        buffer_( std::move( rhs.buffer_ ) ) ,
+        data_( rhs.data_ ) ,
+        size_( rhs.size_ )
+    {
+      rhs.data_ = nullptr;
+    }
+    ~host_view()
+    {
+      if( data_ )
+      {
+        clEnqueueUnmapMemObject( queue_ , buffer_ , data_ , 0 , nullptr , nullptr );
+      }
+    }
+
+    T* data() const
+    {
+      return data_;
+    }
+    size_t size() const
+    {
+      return size_;
+    }
+    T& operator[]( size_t i ) const
+    {
+      return data_[i];
+    }
+    iterator begin() const
+    {
+      return data_;
+    }
+    iterator end() const
+    {
+      return data_ + size_;
+    }
+  };
+
+protected:
+  CommandQueue queue_;
+  Context context_;
+  cl_mem_flags flags_;
+  Buffer buffer_;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+  // pushed , not written yet
+  std::vector< T > pending_;
+  // being written; reused once fence_ completed
+  std::vector< T > in_flight_;
+  detail::SharedEvent fence_;
+
+  bool grow_( size_t n , int* errp )
+  {
+    if( n <= capacity_ )
+    {
+      return true;
+    }
+    return reallocate_( std::max( n , capacity_ * 2 ) , errp );
+  }
+  bool reallocate_( size_t capacity , int* errp )
+  {
+    Buffer buffer( context_ , flags_ , std::max< size_t >( capacity , 1 ) * sizeof(T) ,
+        nullptr , errp );
+    if( !buffer )
+    {
+      return false;
+    }
+    if( size_ > 0 )
+    {
+      // the old buffer lives on until the copy completed
+      int err;
+      queue_.copy_buffer( no_event , buffer_ , buffer , 0 , 0 , size_ * sizeof(T) ,
+          nullptr , &err );
+      EC_CHECK_ERROR( err , errp , return false )
+    }
+    buffer_ = std::move( buffer );
+    capacity_ = capacity;
+    return true;
+  }
+
+public:
+  device_vector( CommandQueue queue , size_t n=0 ,
+      cl_mem_flags flags=CL_MEM_READ_WRITE ,
+      int* errp=nullptr )
+    : queue_( std::move( queue ) ) ,
+      flags_( flags )
+  {
+    context_ = queue_.context( errp );
+    if( n > 0 && reallocate_( n , errp ) )
+    {
+      size_ = n;
+    }
+  }
+  device_vector( device_vector const& ) = delete;
+  device_vector& operator=( device_vector const& ) = delete;
+  device_vector( device_vector&& ) = default;
+  ~device_vector()
+  {
+    // in_flight_ may still be read by the last flush
+    const cl_event fence = fence_.get();
+    if( fence )
+    {
+      clWaitForEvents( 1 , &fence );
+    }
+  }
+
+  // elements on the device plus pending pushes
+  size_t size() const
+  {
+    return size_ + pending_.size();
+  }
+  bool empty() const
+  {
+    return size() == 0;
+  }
+  size_t capacity() const
+  {
+    return capacity_;
+  }
+  // valid until the next reallocation
+  Buffer const& buffer() const
+  {
+    return buffer_;
+  }
+  CommandQueue const& queue() const
+  {
+    return queue_;
+  }
+
+  void push_back( T const& value )
+  {
+    pending_.push_back( value );
+  }
+
+  // writes pending pushes with one write_buffer
+  Event flush( int* errp=nullptr )
+  {
+    if( pending_.empty() )
+    {
+      EC_SET_ERRP( errp )
+      return {};
+    }
+    if( !grow_( size_ + pending_.size() , errp ) )
+    {
+      return {};
+    }
+    if( fence_ )
+    {
+      int err;
+      fence_.wait( &err );
+      EC_CHECK_ERROR( err , errp , return {} )
+    }
+    in_flight_.swap( pending_ );
+    pending_.clear();
+    Event ret = queue_.write_buffer( buffer_ , CL_FALSE , size_ * sizeof(T) ,
+        in_flight_.size() * sizeof(T) , in_flight_.data() , nullptr , errp );
+    if( !ret )
+    {
+      return {};
+    }
+    fence_ = ret.share();
+    size_ += in_flight_.size();
+    return ret;
+  }
+
+  void reserve( size_t n , int* errp=nullptr )
+  {
+    if( n > capacity_ )
+    {
+      if( !reallocate_( n , errp ) )
+      {
+        return;
+      }
+    }
+    EC_SET_ERRP( errp )
+  }
+  // new elements are left uninitialized
+  void resize( size_t n , int* errp=nullptr )
+  {
+    flush( errp );
+    if( !grow_( n , errp ) )
+    {
+      return;
+    }
+    size_ = n;
+    EC_SET_ERRP( errp )
+  }
+  Event resize( size_t n , T const& value , int* errp=nullptr )
+  {
+    const size_t old = size();
+    resize( n , errp );
+    if( n <= old )
+    {
+      return {};
+    }
+    return fill( value , old , n - old , nullptr , errp );
+  }
+  void clear()
+  {
+    pending_.clear();
+    size_ = 0;
+  }
+  // releases unused capacity
+  void shrink_to_fit( int* errp=nullptr )
+  {
+    flush( errp );
+    if( capacity_ > size_ )
+    {
+      reallocate_( size_ , errp );
+    }
+  }
+
+  // sizeof(T) must be a pattern size fill_buffer accepts: 1 , 2 , 4 , ... , 128
+  Event fill( T const& value , size_t first , size_t count ,
+      detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr )
+  {
+    flush( errp );
+    if( count == 0 )
+    {
+      return {};
+    }
+    return queue_.fill_buffer( buffer_ , value , first * sizeof(T) , count , events , errp );
+  }
+  Event fill( T const& value , int* errp=nullptr )
+  {
+    return fill( value , 0 , size() , nullptr , errp );
+  }
+
+  // replaces the contents with n elements from data; data must stay
+  // valid until the returned event completed
+  Event assign( T const* data , size_t n ,
+      detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr )
+  {
+    pending_.clear();
+    size_ = 0;
+    if( n == 0 )
+    {
+      EC_SET_ERRP( errp )
+      return {};
+    }
+    if( !grow_( n , errp ) )
+    {
+      return {};
+    }
+    size_ = n;
+    return queue_.write_buffer( buffer_ , CL_FALSE , 0 , n * sizeof(T) , data , events , errp );
+  }
+  Event read( T* out , size_t first , size_t count , cl_bool block=CL_TRUE ,
+      detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr )
+  {
+    flush( errp );
+    if( count == 0 )
+    {
+      return {};
+    }
+    return queue_.read_buffer( buffer_ , block , first * sizeof(T) , count * sizeof(T) ,
+        out , events , errp );
+  }
+  std::vector< T > to_host( int* errp=nullptr )
+  {
+    std::vector< T > ret( size() );
+    read( ret.data() , 0 , ret.size() , CL_TRUE , nullptr , errp );
+    return ret;
+  }
+
+  // blocking map of [first,first+count); the view unmaps on destruction
+  host_view map( size_t first , size_t count ,
+      cl_map_flags flags=CL_MAP_READ | CL_MAP_WRITE ,
+      int* errp=nullptr )
+  {
+    flush( errp );
+    if( count == 0 )
+    {
+      return { queue_ , buffer_ , nullptr , 0 };
+    }
+    T* ptr = queue_.map_buffer< T >( buffer_ , CL_TRUE , flags ,
+        first * sizeof(T) , count * sizeof(T) , nullptr , errp );
+    return { queue_ , buffer_ , ptr , ptr ? count : 0 };
+  }
+  host_view map( cl_map_flags flags=CL_MAP_READ | CL_MAP_WRITE , int* errp=nullptr )
+  {
+    return map( 0 , size() , flags , errp );
+  }
+};
+
+}
@@ -8,6 +8,8 @@
 namespace ec { namespace detail
 {
 
+class UniqueEvent;
+
 class EventBase
 {
   friend void swap( EventBase& , EventBase& );
@@ -80,6 +82,16 @@ public:
   {
     set_callback( func , CL_COMPLETE , userdata , errp );
   }
+  // blocks in clWaitForEvents; see wait.hpp for spinning and timeouts
+  void wait( int* errp=nullptr ) const
+  {
+    const int err = clWaitForEvents( 1 , &data_ );
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  // run func() on the host once this event completes; see continuation.hpp
+  template < typename F >
+  UniqueEvent then( F&& func , int* errp=nullptr ) const;
 
 protected:
   template < typename T >
@@ -91,6 +103,14 @@ protected:
     EC_SET_ERRP( errp )
     return ret;
   }
+  cl_ulong get_profiling_info_( cl_profiling_info info , int* errp ) const
+  {
+    cl_ulong ret;
+    const int err = clGetEventProfilingInfo( get() , info , sizeof(ret) , &ret , nullptr );
+    EC_CHECK_ERROR( err , errp , return {} )
+    EC_SET_ERRP( errp )
+    return ret;
+  }
 
 public:
   cl_uint reference_count( int* errp=nullptr ) const
@@ -107,6 +127,25 @@ public:
   }
   Context context( int* errp=nullptr ) const;
   CommandQueue command_queue( int* errp=nullptr ) const;
+
+  // device timestamps in nanoseconds.
+  // the queue must be created with CommandQueue::PROFILING
+  cl_ulong profiling_queued( int* errp=nullptr ) const
+  {
+    return get_profiling_info_( CL_PROFILING_COMMAND_QUEUED , errp );
+  }
+  cl_ulong profiling_submit( int* errp=nullptr ) const
+  {
+    return get_profiling_info_( CL_PROFILING_COMMAND_SUBMIT , errp );
+  }
+  cl_ulong profiling_start( int* errp=nullptr ) const
+  {
+    return get_profiling_info_( CL_PROFILING_COMMAND_START , errp );
+  }
+  cl_ulong profiling_end( int* errp=nullptr ) const
+  {
+    return get_profiling_info_( CL_PROFILING_COMMAND_END , errp );
+  }
 };
 inline void swap( EventBase& l , EventBase& r )
 {
@@ -178,11 +217,178 @@ public:
   }
 };
 
-inline EventBase make_system_event( cl_event event )
+// events released by UniqueEvent are queued here and handed back to the
+// driver in one batch from CommandQueue::flush() / finish() ,
+// instead of calling clReleaseEvent() on every destruction.
+// a thread gets its list on its first flush() / finish(); until then , and
+// once the list was destroyed at thread exit , events are released at once.
+// so callback and executor threads never hold events back , and a thread
+// that stopped flushing holds at most capacity of them.
+class EventReleaseList
+{
+  std::vector< cl_event > events_;
+
+  // trivially destructible , so it can still be read during thread exit
+  struct state_t
+  {
+    // local() while it is alive
+    EventReleaseList* list;
+    bool exited;
+  };
+  static state_t& state_()
+  {
+    thread_local state_t ret = { nullptr , false };
+    return ret;
+  }
+
+public:
+  // drained inline once this many events are pending,
+  // so memory stays bounded even if the queue is never flushed
+  constexpr static size_t capacity = 1024;
+
+  EventReleaseList()
+  {
+    events_.reserve( capacity );
+  }
+  ~EventReleaseList()
+  {
+    drain();
+  }
+  EventReleaseList( EventReleaseList const& ) = delete;
+  EventReleaseList& operator=( EventReleaseList const& ) = delete;
+
+  void push( cl_event event )
+  {
+    events_.push_back( event );
+    if( events_.size() >= capacity )
+    {
+      drain();
+    }
+  }
+  void drain()
+  {
+    for( cl_event event : events_ )
+    {
+      clReleaseEvent( event );
+    }
+    events_.clear();
+  }
+  size_t size() const
+  {
+    return events_.size();
+  }
+
+  // one list per thread; no locking on the hot path
+  static EventReleaseList& local()
+  {
+    struct owner_t
+    {
+      EventReleaseList list;
+      owner_t()
+      {
+        state_().list = &list;
+      }
+      // before list drains
+      ~owner_t()
+      {
+        state_().list = nullptr;
+        state_().exited = true;
+      }
+    };
+    thread_local owner_t owner;
+    return owner.list;
+  }
+  // from CommandQueue::flush() / finish(): creates this thread's list , or
+  // drains it; does nothing once it was destroyed at thread exit
+  static void drain_local()
+  {
+    if( !state_().exited )
+    {
+      local().drain();
+    }
+  }
+  // queues event on this thread's list , or releases it if there is none
+  static void release( cl_event event )
+  {
+    EventReleaseList* list = state_().list;
+    if( list != nullptr )
+    {
+      list->push( event );
+    }
+    else
+    {
+      clReleaseEvent( event );
+    }
+  }
+};
+
+// owning , move-only event.
+// returned by every CommandQueue enqueue; the reference is released
+// through EventReleaseList when the object dies.
+class UniqueEvent
+  : public SharedEvent
+{
+  void defer_release_()
+  {
+    if( data_ != NULL )
+    {
+      EventReleaseList::release( data_ );
+      data_ = NULL;
+    }
+  }
+
+public:
+  UniqueEvent()
+    : SharedEvent()
+  {
+  }
+  UniqueEvent( cl_event data )
+    : SharedEvent( data )
+  {
+  }
+  UniqueEvent( cl_event data , no_retain_t )
+    : SharedEvent( data , no_retain_t() )
+  {
+  }
+  UniqueEvent( cl_context context , int* errp=nullptr )
+    : SharedEvent( context , errp )
+  {
+  }
+  ~UniqueEvent()
+  {
+    defer_release_();
+  }
+  UniqueEvent( UniqueEvent const& ) = delete;
+  UniqueEvent& operator=( UniqueEvent const& ) = delete;
+  UniqueEvent( UniqueEvent&& rhs )
+    : SharedEvent()
+  {
+    data_ = rhs.data_;
+    rhs.data_ = NULL;
+  }
+  UniqueEvent& operator=( UniqueEvent&& rhs )
+  {
+    if( this != &rhs )
+    {
+      defer_release_();
+      data_ = rhs.data_;
+      rhs.data_ = NULL;
+    }
+    return *this;
+  }
+
+  // new shared reference to the same event
+  SharedEvent share() const
+  {
+    return { get() };
+  }
+};
+
+inline UniqueEvent make_system_event( cl_event event )
 {
-  return { event };
+  return { event , no_retain_t() };
 }
-inline EventBase make_system_event()
+inline UniqueEvent make_system_event()
 {
   return {};
 }
@@ -192,6 +398,6 @@ inline EventBase make_system_event()
 namespace ec
 {
 
-using Event = detail::EventBase;
+using Event = detail::UniqueEvent;
 
 }
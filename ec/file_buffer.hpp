@@ -0,0 +1,204 @@
+#pragma once
+
+// file contents as device buffers through mmap; POSIX only.
+#if defined(__linux__) || defined(__APPLE__) || defined(__unix__)
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "definitions.hpp"
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ec
+{
+
+// private , writable mapping of a whole file. writes stay in memory ,
+// which lets a CL_MEM_USE_HOST_PTR buffer over it be written by kernels
+class MappedFile
+{
+protected:
+  void* data_ = nullptr;
+  size_t size_ = 0;
+
+public:
+  explicit MappedFile( const char* path , int* errp=nullptr )
+  {
+    const int fd = ::open( path , O_RDONLY | O_CLOEXEC );
+    struct stat st;
+    int err = CL_SUCCESS;
+    if( fd < 0 || ::fstat( fd , &st ) != 0 )
+    {
+      err = CL_INVALID_VALUE;
+    }
+    else if( st.st_size == 0 )
+    {
+      err = CL_INVALID_BUFFER_SIZE;
+    }
+    else
+    {
+      void* ptr = ::mmap( nullptr , static_cast< size_t >( st.st_size ) ,
+          PROT_READ | PROT_WRITE , MAP_PRIVATE , fd , 0 );
+      if( ptr == MAP_FAILED )
+      {
+        err = CL_OUT_OF_HOST_MEMORY;
+      }
+      else
+      {
+        data_ = ptr;
+        size_ = static_cast< size_t >( st.st_size );
+      }
+    }
+    if( fd >= 0 )
+    {
+      // the mapping keeps the file
+      ::close( fd );
+    }
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  MappedFile( MappedFile const& ) = delete;
+  MappedFile& operator=( MappedFile const& ) = delete;
+  ~MappedFile()
+  {
+    if( data_ )
+    {
+      ::munmap( data_ , size_ );
+    }
+  }
+
+  void* data() const
+  {
+    return data_;
+  }
+  size_t size() const
+  {
+    return size_;
+  }
+  explicit operator bool() const
+  {
+    return data_ != nullptr;
+  }
+  // posix_madvise over [offset,offset+size) , widened to whole pages
+  void advise( size_t offset , size_t size , int advice ) const
+  {
+    static const size_t page = static_cast< size_t >( ::sysconf( _SC_PAGESIZE ) );
+    const size_t begin = offset / page * page;
+    const size_t end = std::min( size_ , offset + size );
+    if( data_ && end > begin )
+    {
+      ::posix_madvise( static_cast< char* >( data_ ) + begin , end - begin , advice );
+    }
+  }
+};
+
+struct FileBuffer
+{
+  Buffer buffer;
+  // completes once buffer holds the file; empty when usable at once
+  Event ready;
+  // buffer aliases the mapping instead of holding a copy
+  bool zero_copy = false;
+};
+
+namespace detail
+{
+inline void release_mapping_( cl_mem , void* userdata )
+{
+  delete static_cast< std::shared_ptr< MappedFile >* >( userdata );
+}
+inline void release_mapping_( cl_event , cl_int , void* userdata )
+{
+  delete static_cast< std::shared_ptr< MappedFile >* >( userdata );
+}
+}
+
+// maps the file at path and turns it into a buffer of the queue's context.
+// on a host-unified device the buffer is CL_MEM_USE_HOST_PTR over the
+// mapping , which is unmapped from the buffer's destructor callback.
+// otherwise the mapping is read sequentially in window-sized write_buffer
+// calls straight from the mapped pages , with readahead one window ahead;
+// window is rounded up to whole pages. the mapping goes once every write
+// completed. does not block
+inline FileBuffer load_file( CommandQueue const& queue , const char* path ,
+    cl_mem_flags flags=CL_MEM_READ_ONLY ,
+    size_t window=size_t(64)<<20 ,
+    int* errp=nullptr )
+{
+  FileBuffer ret;
+  auto file = std::make_shared< MappedFile >( path , errp );
+  if( !*file )
+  {
+    return ret;
+  }
+  const Context context = queue.context( errp );
+  const Device device = queue.device( errp );
+  if( device.get_info< CL_DEVICE_HOST_UNIFIED_MEMORY >( errp ) )
+  {
+    ret.buffer = Buffer( context , flags | CL_MEM_USE_HOST_PTR , file->size() ,
+        file->data() , errp );
+    if( !ret.buffer )
+    {
+      return ret;
+    }
+    // the runtime reads the mapping on demand , in any order
+    file->advise( 0 , file->size() , POSIX_MADV_WILLNEED );
+    // owned here until the callback holds it; nothing was enqueued , so on
+    // failure the mapping is unused once the buffer is released
+    std::unique_ptr< std::shared_ptr< MappedFile > > held( new std::shared_ptr< MappedFile >( file ) );
+    int err;
+    ret.buffer.setDestructor( detail::release_mapping_ , held.get() , &err );
+    EC_CHECK_ERROR( err , errp , return {} )
+    held.release();
+    ret.zero_copy = true;
+    return ret;
+  }
+
+  ret.buffer = Buffer( context , flags , file->size() , nullptr , errp );
+  if( !ret.buffer )
+  {
+    return ret;
+  }
+  // whole pages , so readahead never splits a page between two windows
+  const size_t page = static_cast< size_t >( ::sysconf( _SC_PAGESIZE ) );
+  window = ( std::max< size_t >( window , 1 ) + page - 1 ) / page * page;
+  file->advise( 0 , file->size() , POSIX_MADV_SEQUENTIAL );
+  file->advise( 0 , window , POSIX_MADV_WILLNEED );
+  std::vector< Event > writes;
+  std::vector< cl_event > events;
+  for( size_t offset=0; offset<file->size(); offset+=window )
+  {
+    const size_t n = std::min( window , file->size() - offset );
+    // fault in the next window while this one is transferred
+    file->advise( offset + n , window , POSIX_MADV_WILLNEED );
+    Event write = queue.write_buffer( ret.buffer , CL_FALSE , offset , n ,
+        static_cast< char const* >( file->data() ) + offset , nullptr , errp );
+    if( !write )
+    {
+      return {};
+    }
+    // every write keeps the mapping until it completed
+    auto held = new std::shared_ptr< MappedFile >( file );
+    const int err = clSetEventCallback( write.get() , CL_COMPLETE , detail::release_mapping_ , held );
+    if( err != CL_SUCCESS )
+    {
+      write.wait();
+      delete held;
+    }
+    EC_CHECK_ERROR( err , errp , return {} )
+    events.push_back( write.get() );
+    writes.push_back( std::move( write ) );
+  }
+  // out-of-order queues may finish the windows in any order
+  ret.ready = events.size() == 1 ? std::move( writes.back() ) : queue.marker( events , errp );
+  queue.flush();
+  return ret;
+}
+
+}
+
+#endif
@@ -0,0 +1,581 @@
+#pragma once
+
+// streams a file through kernels , reading straight into mapped staging
+// buffers; io_uring on linux , pread threads elsewhere. POSIX only.
+#if defined(__linux__) || defined(__APPLE__) || defined(__unix__)
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "definitions.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define EC_INGEST_URING
+#endif
+#endif
+
+namespace ec { namespace detail
+{
+
+// read requests tagged with a slot; complete() returns ( slot , bytes or -errno )
+class pread_reader_
+{
+protected:
+  struct request_t
+  {
+    size_t slot;
+    int fd;
+    void* ptr;
+    size_t size;
+    off_t offset;
+  };
+
+  std::mutex mutex_;
+  std::condition_variable requested_;
+  std::condition_variable completed_;
+  std::deque< request_t > requests_;
+  std::deque< std::pair< size_t , long > > done_;
+  std::vector< std::thread > threads_;
+  bool stop_ = false;
+
+  void work_()
+  {
+    std::unique_lock< std::mutex > lock( mutex_ );
+    for( ;; )
+    {
+      requested_.wait( lock , [this]{ return stop_ || !requests_.empty(); } );
+      if( requests_.empty() )
+      {
+        return;
+      }
+      const request_t r = requests_.front();
+      requests_.pop_front();
+      lock.unlock();
+      long got = 0;
+      while( static_cast< size_t >( got ) < r.size )
+      {
+        const ssize_t n = ::pread( r.fd , static_cast< char* >( r.ptr ) + got ,
+            r.size - got , r.offset + got );
+        if( n < 0 && errno == EINTR )
+        {
+          continue;
+        }
+        if( n < 0 )
+        {
+          got = -errno;
+          break;
+        }
+        if( n == 0 )
+        {
+          break;
+        }
+        got += n;
+      }
+      lock.lock();
+      done_.emplace_back( r.slot , got );
+      completed_.notify_one();
+    }
+  }
+
+public:
+  explicit pread_reader_( size_t threads )
+  {
+    for( size_t i=0; i<threads; ++i )
+    {
+      threads_.emplace_back( [this]{ work_(); } );
+    }
+  }
+  ~pread_reader_()
+  {
+    {
+      std::lock_guard< std::mutex > lock( mutex_ );
+      stop_ = true;
+    }
+    requested_.notify_all();
+    for( auto& t : threads_ )
+    {
+      t.join();
+    }
+  }
+  bool submit( size_t slot , int fd , void* ptr , size_t size , off_t offset )
+  {
+    {
+      std::lock_guard< std::mutex > lock( mutex_ );
+      requests_.push_back( { slot , fd , ptr , size , offset } );
+    }
+    requested_.notify_one();
+    return true;
+  }
+  std::pair< size_t , long > complete()
+  {
+    std::unique_lock< std::mutex > lock( mutex_ );
+    completed_.wait( lock , [this]{ return !done_.empty(); } );
+    const auto ret = done_.front();
+    done_.pop_front();
+    return ret;
+  }
+};
+
+#ifdef EC_INGEST_URING
+// the submission and completion rings of one io_uring , driven through the
+// raw syscalls; only IORING_OP_READ is used
+class uring_reader_
+{
+protected:
+  int fd_ = -1;
+  void* sq_ring_ = MAP_FAILED;
+  void* cq_ring_ = MAP_FAILED;
+  size_t sq_size_ = 0;
+  size_t cq_size_ = 0;
+  io_uring_sqe* sqes_ = static_cast< io_uring_sqe* >( MAP_FAILED );
+  size_t sqes_size_ = 0;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  io_uring_cqe* cqes_;
+
+  static unsigned* at_( void* ring , size_t offset )
+  {
+    return reinterpret_cast< unsigned* >( static_cast< char* >( ring ) + offset );
+  }
+  // IORING_REGISTER_PROBE came with IORING_OP_READ , failing it means no read
+  bool supports_read_() const
+  {
+    constexpr unsigned ops = 256;
+    std::vector< unsigned char > buf( sizeof(io_uring_probe) + ops * sizeof(io_uring_probe_op) );
+    io_uring_probe* probe = reinterpret_cast< io_uring_probe* >( buf.data() );
+    if( ::syscall( __NR_io_uring_register , fd_ , IORING_REGISTER_PROBE , probe , ops ) < 0 )
+    {
+      return false;
+    }
+    return probe->ops_len > IORING_OP_READ &&
+      ( probe->ops[ IORING_OP_READ ].flags & IO_URING_OP_SUPPORTED ) != 0;
+  }
+
+public:
+  explicit uring_reader_( unsigned entries )
+  {
+    io_uring_params p;
+    std::memset( &p , 0 , sizeof(p) );
+    fd_ = static_cast< int >( ::syscall( __NR_io_uring_setup , entries , &p ) );
+    if( fd_ < 0 )
+    {
+      return;
+    }
+    if( !supports_read_() )
+    {
+      // kernels before 5.6 have rings but fail every IORING_OP_READ
+      ::close( fd_ );
+      fd_ = -1;
+      return;
+    }
+    sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single = ( p.features & IORING_FEAT_SINGLE_MMAP ) != 0;
+    if( single )
+    {
+      sq_size_ = cq_size_ = std::max( sq_size_ , cq_size_ );
+    }
+    sq_ring_ = ::mmap( nullptr , sq_size_ , PROT_READ | PROT_WRITE ,
+        MAP_SHARED | MAP_POPULATE , fd_ , IORING_OFF_SQ_RING );
+    cq_ring_ = single ? sq_ring_ : ::mmap( nullptr , cq_size_ , PROT_READ | PROT_WRITE ,
+        MAP_SHARED | MAP_POPULATE , fd_ , IORING_OFF_CQ_RING );
+    sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast< io_uring_sqe* >( ::mmap( nullptr , sqes_size_ ,
+          PROT_READ | PROT_WRITE , MAP_SHARED | MAP_POPULATE , fd_ , IORING_OFF_SQES ) );
+    if( sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED )
+    {
+      ::close( fd_ );
+      fd_ = -1;
+      return;
+    }
+    sq_tail_ = at_( sq_ring_ , p.sq_off.tail );
+    sq_mask_ = at_( sq_ring_ , p.sq_off.ring_mask );
+    sq_array_ = at_( sq_ring_ , p.sq_off.array );
+    cq_head_ = at_( cq_ring_ , p.cq_off.head );
+    cq_tail_ = at_( cq_ring_ , p.cq_off.tail );
+    cq_mask_ = at_( cq_ring_ , p.cq_off.ring_mask );
+    cqes_ = reinterpret_cast< io_uring_cqe* >( static_cast< char* >( cq_ring_ ) + p.cq_off.cqes );
+  }
+  uring_reader_( uring_reader_ const& ) = delete;
+  uring_reader_& operator=( uring_reader_ const& ) = delete;
+  ~uring_reader_()
+  {
+    if( sqes_ != MAP_FAILED )
+    {
+      ::munmap( sqes_ , sqes_size_ );
+    }
+    if( cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_ )
+    {
+      ::munmap( cq_ring_ , cq_size_ );
+    }
+    if( sq_ring_ != MAP_FAILED )
+    {
+      ::munmap( sq_ring_ , sq_size_ );
+    }
+    if( fd_ >= 0 )
+    {
+      ::close( fd_ );
+    }
+  }
+  explicit operator bool() const
+  {
+    return fd_ >= 0;
+  }
+
+  // never more requests in flight than entries
+  bool submit( size_t slot , int fd , void* ptr , size_t size , off_t offset )
+  {
+    // this thread is the only producer
+    const unsigned tail = *sq_tail_;
+    const unsigned index = tail & *sq_mask_;
+    io_uring_sqe* sqe = sqes_ + index;
+    std::memset( sqe , 0 , sizeof(*sqe) );
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast< __u64 >( ptr );
+    sqe->len = static_cast< __u32 >( size );
+    sqe->off = static_cast< __u64 >( offset );
+    sqe->user_data = slot;
+    sq_array_[ index ] = index;
+    __atomic_store_n( sq_tail_ , tail + 1 , __ATOMIC_RELEASE );
+    for( ;; )
+    {
+      const long ret = ::syscall( __NR_io_uring_enter , fd_ , 1 , 0 , 0 , nullptr , 0 );
+      if( ret >= 0 )
+      {
+        return true;
+      }
+      if( errno != EINTR && errno != EAGAIN )
+      {
+        return false;
+      }
+    }
+  }
+  std::pair< size_t , long > complete()
+  {
+    const unsigned head = *cq_head_;
+    while( head == __atomic_load_n( cq_tail_ , __ATOMIC_ACQUIRE ) )
+    {
+      ::syscall( __NR_io_uring_enter , fd_ , 0 , 1 , IORING_ENTER_GETEVENTS , nullptr , 0 );
+    }
+    io_uring_cqe const& cqe = cqes_[ head & *cq_mask_ ];
+    const std::pair< size_t , long > ret( static_cast< size_t >( cqe.user_data ) , cqe.res );
+    __atomic_store_n( cq_head_ , head + 1 , __ATOMIC_RELEASE );
+    return ret;
+  }
+};
+#endif
+
+}}
+
+namespace ec
+{
+
+// replays a file through kernels in chunks , without a host-side copy.
+// every slot is a CL_MEM_ALLOC_HOST_PTR buffer mapped for writing; reads go
+// straight into the mapping , O_DIRECT when the file system and alignment
+// allow it. when a read completes its buffer is unmapped and handed to the
+// consumer , which enqueues the kernels reading it; the buffer is mapped
+// again behind them and refilled once that map completed.
+// reads use io_uring where available and a pool of pread threads otherwise.
+class FileIngest
+{
+public:
+  enum backend_t { URING , THREADS };
+
+  struct stats_t
+  {
+    size_t chunks = 0;
+    size_t bytes = 0;
+    double wall = 0;
+    // file opened with O_DIRECT
+    bool direct = false;
+    backend_t backend = THREADS;
+  };
+
+protected:
+  struct slot_t
+  {
+    Buffer buffer;
+    void* ptr = nullptr;
+    // the map issued after the consumer; ptr is writable once complete
+    Event mapped;
+    size_t offset = 0;
+    size_t size = 0;
+    size_t done = 0;
+  };
+
+  CommandQueue queue_;
+  size_t chunk_size_;
+  backend_t preferred_;
+  std::vector< slot_t > slots_;
+  stats_t stats_;
+
+  // O_DIRECT needs block-aligned addresses , lengths and offsets
+  constexpr static size_t direct_align_ = 4096;
+
+  bool aligned_() const
+  {
+    if( chunk_size_ % direct_align_ != 0 )
+    {
+      return false;
+    }
+    for( auto const& slot : slots_ )
+    {
+      if( reinterpret_cast< uintptr_t >( slot.ptr ) % direct_align_ != 0 )
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template < typename Reader , typename F >
+  void run_( Reader& reader , int fd , size_t file_size , F& consume , int* errp )
+  {
+    std::vector< size_t > free;
+    for( size_t i=slots_.size(); i>0; --i )
+    {
+      free.push_back( i - 1 );
+    }
+    size_t next = 0;
+    size_t in_flight = 0;
+    int err = CL_SUCCESS;
+    for( ;; )
+    {
+      while( err == CL_SUCCESS && next < file_size && !free.empty() )
+      {
+        slot_t& slot = slots_[ free.back() ];
+        if( slot.mapped )
+        {
+          // the consumer of the previous chunk is done with it
+          slot.mapped.wait( errp );
+          slot.mapped = Event();
+        }
+        slot.offset = next;
+        slot.size = std::min( chunk_size_ , file_size - next );
+        slot.done = 0;
+        // whole blocks for O_DIRECT; the tail read comes back short
+        const size_t request = stats_.direct ?
+          ( slot.size + direct_align_ - 1 ) / direct_align_ * direct_align_ : slot.size;
+        if( !reader.submit( free.back() , fd , slot.ptr , request , static_cast< off_t >( next ) ) )
+        {
+          err = CL_OUT_OF_RESOURCES;
+          break;
+        }
+        free.pop_back();
+        next += slot.size;
+        ++in_flight;
+      }
+      if( in_flight == 0 )
+      {
+        break;
+      }
+      const std::pair< size_t , long > c = reader.complete();
+      slot_t& slot = slots_[ c.first ];
+      if( c.second < 0 || ( c.second == 0 && slot.done < slot.size ) )
+      {
+        // keep draining , reads in flight still target the mappings
+        err = CL_INVALID_VALUE;
+        --in_flight;
+        free.push_back( c.first );
+        continue;
+      }
+      slot.done += static_cast< size_t >( c.second );
+      if( slot.done < slot.size && err == CL_SUCCESS )
+      {
+        // short read; O_DIRECT resumes at the block holding the first
+        // missing byte , with a whole number of blocks
+        if( stats_.direct )
+        {
+          slot.done = slot.done / direct_align_ * direct_align_;
+        }
+        const size_t rest = slot.size - slot.done;
+        const size_t request = stats_.direct ?
+          ( rest + direct_align_ - 1 ) / direct_align_ * direct_align_ : rest;
+        if( !reader.submit( c.first , fd , static_cast< char* >( slot.ptr ) + slot.done ,
+              request , static_cast< off_t >( slot.offset + slot.done ) ) )
+        {
+          err = CL_OUT_OF_RESOURCES;
+          --in_flight;
+          free.push_back( c.first );
+        }
+        continue;
+      }
+      --in_flight;
+      if( err != CL_SUCCESS )
+      {
+        free.push_back( c.first );
+        continue;
+      }
+
+      Event unmapped = queue_.unmap( slot.buffer , slot.ptr , nullptr , errp );
+      slot.ptr = nullptr;
+      Event consumed = consume( slot.buffer , slot.offset , slot.size , unmapped.get() );
+      int map_err = CL_SUCCESS;
+      slot.ptr = queue_.map_buffer( slot.buffer , CL_FALSE , CL_MAP_WRITE_INVALIDATE_REGION ,
+          0 , chunk_size_ , consumed ? consumed.get() : unmapped.get() , slot.mapped , &map_err );
+      queue_.flush();
+      ++stats_.chunks;
+      stats_.bytes += slot.size;
+      if( slot.ptr == nullptr )
+      {
+        // nothing to read into , the slot is not refilled
+        err = map_err != CL_SUCCESS ? map_err : CL_MAP_FAILURE;
+        continue;
+      }
+      free.push_back( c.first );
+    }
+    EC_CHECK_ERROR( err , errp , return )
+  }
+
+public:
+  // chunk_size should be a multiple of 4 KiB for O_DIRECT
+  FileIngest( CommandQueue queue ,
+      size_t chunk_size=size_t(4)<<20 ,
+      size_t depth=4 ,
+      backend_t preferred=URING ,
+      int* errp=nullptr )
+    : queue_( std::move( queue ) ) ,
+      chunk_size_( chunk_size ) ,
+      preferred_( preferred )
+  {
+    const Context context = queue_.context( errp );
+    slots_.resize( std::max< size_t >( depth , 1 ) );
+    for( auto& slot : slots_ )
+    {
+      slot.buffer = Buffer( context , CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR ,
+          chunk_size_ , nullptr , errp );
+      if( !slot.buffer )
+      {
+        return;
+      }
+      slot.ptr = queue_.map_buffer( slot.buffer , CL_TRUE , CL_MAP_WRITE_INVALIDATE_REGION ,
+          0 , chunk_size_ , nullptr , errp );
+      if( slot.ptr == nullptr )
+      {
+        return;
+      }
+    }
+  }
+  FileIngest( FileIngest const& ) = delete;
+  FileIngest& operator=( FileIngest const& ) = delete;
+  ~FileIngest()
+  {
+    for( auto& slot : slots_ )
+    {
+      const cl_event mapped = slot.mapped.get();
+      if( slot.ptr )
+      {
+        clEnqueueUnmapMemObject( queue_ , slot.buffer , slot.ptr ,
+            mapped ? 1 : 0 , mapped ? &mapped : nullptr , nullptr );
+      }
+    }
+    queue_.finish();
+  }
+
+  size_t chunk_size() const
+  {
+    return chunk_size_;
+  }
+  size_t depth() const
+  {
+    return slots_.size();
+  }
+  // of the last run()
+  stats_t const& stats() const
+  {
+    return stats_;
+  }
+
+  // reads the whole file at path. for every chunk calls
+  //   Event consume( Buffer const& chunk , size_t file_offset , size_t size ,
+  //       cl_event unmapped )
+  // which enqueues work on chunk after unmapped and returns the event after
+  // which chunk may be refilled. returns once every chunk was handed over;
+  // the consumers' commands may still run
+  template < typename F >
+  stats_t const& run( const char* path , F&& consume , int* errp=nullptr )
+  {
+    const auto begin = std::chrono::steady_clock::now();
+    stats_ = stats_t();
+    int fd = -1;
+#ifdef O_DIRECT
+    if( aligned_() )
+    {
+      fd = ::open( path , O_RDONLY | O_CLOEXEC | O_DIRECT );
+      stats_.direct = fd >= 0;
+    }
+#endif
+    if( fd < 0 )
+    {
+      fd = ::open( path , O_RDONLY | O_CLOEXEC );
+    }
+    struct stat st;
+    if( fd < 0 || ::fstat( fd , &st ) != 0 )
+    {
+      if( fd >= 0 )
+      {
+        ::close( fd );
+      }
+      EC_CHECK_ERROR( CL_INVALID_VALUE , errp , return stats_ )
+    }
+    const size_t file_size = static_cast< size_t >( st.st_size );
+
+    struct closer_t
+    {
+      int fd;
+      ~closer_t()
+      {
+        ::close( fd );
+      }
+    } closer{ fd };
+#ifdef EC_INGEST_URING
+    if( preferred_ == URING )
+    {
+      detail::uring_reader_ reader( static_cast< unsigned >( slots_.size() ) );
+      if( reader )
+      {
+        stats_.backend = URING;
+        run_( reader , fd , file_size , consume , errp );
+        const std::chrono::duration< double > wall = std::chrono::steady_clock::now() - begin;
+        stats_.wall = wall.count();
+        return stats_;
+      }
+    }
+#endif
+    detail::pread_reader_ reader( slots_.size() );
+    stats_.backend = THREADS;
+    run_( reader , fd , file_size , consume , errp );
+    const std::chrono::duration< double > wall = std::chrono::steady_clock::now() - begin;
+    stats_.wall = wall.count();
+    return stats_;
+  }
+};
+
+}
+
+#undef EC_INGEST_URING
+
+#endif
@@ -14,5 +14,6 @@ class Program;
 namespace detail { class KernelArgument; }
 class Kernel;
 class Sampler;
+class StagingPool;
 
 }
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "buffer.hpp"
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace ec
+{
+
+constexpr size_t page_alignment = size_t(4) << 10;
+// transparent huge pages on x86-64 linux
+constexpr size_t huge_page_alignment = size_t(2) << 20;
+
+namespace detail
+{
+
+inline void* aligned_alloc_( size_t alignment , size_t size )
+{
+  // whole alignment units , so the runtime never sees a partial page
+  size = ( size + alignment - 1 ) / alignment * alignment;
+#if defined(_WIN32)
+  void* ret = _aligned_malloc( size , alignment );
+#else
+  void* ret = nullptr;
+  if( posix_memalign( &ret , alignment , size ) != 0 )
+  {
+    ret = nullptr;
+  }
+#endif
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if( ret && alignment >= huge_page_alignment )
+  {
+    // advisory , THP may be disabled
+    madvise( ret , size , MADV_HUGEPAGE );
+  }
+#endif
+  return ret;
+}
+inline void aligned_free_( void* ptr )
+{
+#if defined(_WIN32)
+  _aligned_free( ptr );
+#else
+  std::free( ptr );
+#endif
+}
+
+}
+
+// allocator handing out Alignment-aligned storage rounded up to whole
+// Alignment units , what runtimes want before they use a CL_MEM_USE_HOST_PTR
+// allocation in place instead of copying it.
+// Alignment of huge_page_alignment or more also asks linux for huge pages
+template < typename T , size_t Alignment=page_alignment >
+class aligned_allocator
+{
+  static_assert( ( Alignment & ( Alignment - 1 ) ) == 0 ,
+      "alignment must be a power of two" );
+  static_assert( Alignment >= alignof(T) && Alignment >= sizeof(void*) ,
+      "alignment too small" );
+
+public:
+  using value_type = T;
+  template < typename U >
+  struct rebind
+  {
+    using other = aligned_allocator< U , Alignment >;
+  };
+  constexpr static size_t alignment = Alignment;
+
+  aligned_allocator() = default;
+  template < typename U >
+  aligned_allocator( aligned_allocator< U , Alignment > const& )
+  {
+  }
+
+  T* allocate( size_t n )
+  {
+    void* ret = detail::aligned_alloc_( Alignment , n * sizeof(T) );
+    if( ret == nullptr )
+    {
+      throw std::bad_alloc();
+    }
+    return static_cast< T* >( ret );
+  }
+  void deallocate( T* ptr , size_t )
+  {
+    detail::aligned_free_( ptr );
+  }
+};
+template < typename T , typename U , size_t A >
+bool operator==( aligned_allocator< T , A > const& , aligned_allocator< U , A > const& )
+{
+  return true;
+}
+template < typename T , typename U , size_t A >
+bool operator!=( aligned_allocator< T , A > const& , aligned_allocator< U , A > const& )
+{
+  return false;
+}
+
+template < typename T , size_t Alignment=page_alignment >
+using aligned_vector = std::vector< T , aligned_allocator< T , Alignment > >;
+
+namespace detail
+{
+// destructor callbacks of adopted storage
+template < typename Container >
+void adopted_container_( cl_mem , void* userdata )
+{
+  delete static_cast< Container* >( userdata );
+}
+template < typename Holder >
+void adopted_pointer_( cl_mem , void* userdata )
+{
+  Holder* held = static_cast< Holder* >( userdata );
+  held->deleter( held->ptr );
+  delete held;
+}
+}
+
+// CL_MEM_USE_HOST_PTR buffer over the storage of container , which is moved
+// into the buffer and destroyed from its destructor callback once the
+// runtime released the buffer. on cpu devices the buffer aliases the
+// storage; use an aligned_vector so the runtime has no reason to copy.
+// on failure container is left as it was
+template < typename Container >
+Buffer adopt_buffer( cl_context context , Container&& container ,
+    cl_mem_flags flags=CL_MEM_READ_WRITE ,
+    int* errp=nullptr )
+{
+  static_assert( !std::is_lvalue_reference< Container >::value ,
+      "adopt_buffer takes ownership , pass an rvalue" );
+  using value_type = typename Container::value_type;
+  static_assert( std::is_trivially_copyable< value_type >::value ,
+      "buffer contents are copied bytewise" );
+
+  Container* held = new Container( std::move( container ) );
+  int err;
+  const cl_mem mem = clCreateBuffer( context , flags | CL_MEM_USE_HOST_PTR ,
+      held->size() * sizeof(value_type) , held->data() , &err );
+  if( err == CL_SUCCESS )
+  {
+    err = clSetMemObjectDestructorCallback( mem ,
+        detail::adopted_container_< Container > , held );
+    if( err == CL_SUCCESS )
+    {
+      EC_SET_ERRP( errp )
+      return Buffer( mem , no_retain_t() );
+    }
+    // nothing was enqueued , the storage is unused once released
+    clReleaseMemObject( mem );
+  }
+  container = std::move( *held );
+  delete held;
+  EC_CHECK_ERROR( err , errp , return {} )
+  return {};
+}
+
+// same for raw storage: deleter( ptr ) is called from the destructor
+// callback. on failure the caller keeps ownership of ptr
+template < typename Deleter >
+Buffer adopt_buffer( cl_context context , void* ptr , size_t size , Deleter deleter ,
+    cl_mem_flags flags=CL_MEM_READ_WRITE ,
+    int* errp=nullptr )
+{
+  struct holder_t
+  {
+    void* ptr;
+    Deleter deleter;
+  };
+  int err;
+  const cl_mem mem = clCreateBuffer( context , flags | CL_MEM_USE_HOST_PTR ,
+      size , ptr , &err );
+  EC_CHECK_ERROR( err , errp , return {} )
+  holder_t* held = new holder_t{ ptr , std::move( deleter ) };
+  err = clSetMemObjectDestructorCallback( mem ,
+      detail::adopted_pointer_< holder_t > , held );
+  if( err != CL_SUCCESS )
+  {
+    clReleaseMemObject( mem );
+    delete held;
+  }
+  EC_CHECK_ERROR( err , errp , return {} )
+  EC_SET_ERRP( errp )
+  return Buffer( mem , no_retain_t() );
+}
+
+}
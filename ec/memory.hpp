@@ -2,8 +2,31 @@
 
 #include "cl.hpp"
 #include "global.hpp"
+#include <atomic>
 #include <utility>
 
+namespace ec { namespace detail
+{
+
+// consulted before a Memory drops its reference; returns true if it took
+// the reference over instead. installed by BufferCache , see buffer_cache.hpp
+using release_hook_t = bool (*)( cl_mem );
+inline std::atomic< release_hook_t >& release_hook()
+{
+  static std::atomic< release_hook_t > hook{ nullptr };
+  return hook;
+}
+// told when a Memory takes another reference , or with pin when a
+// sub-buffer of mem is created. installed by BufferCache as well
+using retain_hook_t = void (*)( cl_mem , bool pin );
+inline std::atomic< retain_hook_t >& retain_hook()
+{
+  static std::atomic< retain_hook_t > hook{ nullptr };
+  return hook;
+}
+
+}}
+
 namespace ec
 {
 
@@ -16,13 +39,24 @@ protected:
   {
     if( data_ != NULL )
     {
-      clReleaseMemObject( get() );
+      const detail::release_hook_t hook =
+        detail::release_hook().load( std::memory_order_acquire );
+      if( hook == nullptr || !hook( get() ) )
+      {
+        clReleaseMemObject( get() );
+      }
     }
   }
   void retain_if() const
   {
     if( data_ != NULL )
     {
+      const detail::retain_hook_t hook =
+        detail::retain_hook().load( std::memory_order_acquire );
+      if( hook != nullptr )
+      {
+        hook( get() , false );
+      }
       clRetainMemObject( get() );
     }
   }
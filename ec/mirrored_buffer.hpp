@@ -0,0 +1,431 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "definitions.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ec
+{
+
+namespace detail
+{
+
+// disjoint , non-adjacent [begin,end) ranges
+class interval_set
+{
+  // begin -> end
+  std::map< size_t , size_t > ranges_;
+
+public:
+  using const_iterator = std::map< size_t , size_t >::const_iterator;
+
+  void insert( size_t begin , size_t end )
+  {
+    if( begin >= end )
+    {
+      return;
+    }
+    auto it = ranges_.upper_bound( begin );
+    if( it != ranges_.begin() )
+    {
+      auto prev = std::prev( it );
+      if( prev->second >= begin )
+      {
+        begin = prev->first;
+        end = std::max( end , prev->second );
+        ranges_.erase( prev );
+      }
+    }
+    while( it != ranges_.end() && it->first <= end )
+    {
+      end = std::max( end , it->second );
+      it = ranges_.erase( it );
+    }
+    ranges_.emplace_hint( it , begin , end );
+  }
+  void erase( size_t begin , size_t end )
+  {
+    if( begin >= end )
+    {
+      return;
+    }
+    auto it = ranges_.upper_bound( begin );
+    if( it != ranges_.begin() )
+    {
+      auto prev = std::prev( it );
+      if( prev->second > begin )
+      {
+        const size_t tail = prev->second;
+        if( prev->first == begin )
+        {
+          ranges_.erase( prev );
+        }
+        else
+        {
+          prev->second = begin;
+        }
+        if( tail > end )
+        {
+          ranges_.emplace_hint( it , end , tail );
+          return;
+        }
+      }
+    }
+    while( it != ranges_.end() && it->first < end )
+    {
+      const size_t tail = it->second;
+      it = ranges_.erase( it );
+      if( tail > end )
+      {
+        ranges_.emplace_hint( it , end , tail );
+        return;
+      }
+    }
+  }
+  bool intersects( size_t begin , size_t end ) const
+  {
+    auto it = ranges_.lower_bound( end );
+    if( it == ranges_.begin() )
+    {
+      return false;
+    }
+    return std::prev( it )->second > begin;
+  }
+  void clear()
+  {
+    ranges_.clear();
+  }
+  bool empty() const
+  {
+    return ranges_.empty();
+  }
+  // ranges , not covered values
+  size_t size() const
+  {
+    return ranges_.size();
+  }
+  size_t covered() const
+  {
+    size_t ret = 0;
+    for( auto const& r : ranges_ )
+    {
+      ret += r.second - r.first;
+    }
+    return ret;
+  }
+  const_iterator begin() const
+  {
+    return ranges_.begin();
+  }
+  const_iterator end() const
+  {
+    return ranges_.end();
+  }
+};
+
+}
+
+// host copy and device buffer of the same n elements , with the ranges
+// changed on either side since the last sync tracked separately.
+// host changes go through modify() / write() / mark_host_dirty(); device
+// changes are declared with mark_device_dirty() after enqueueing the
+// kernels that write them.
+// a sync copies only dirty ranges. ranges closer than merge_gap() elements
+// are sent as one , unless the gap is dirty on the other side , and three or
+// more equally sized ranges at a constant stride become one *_buffer_rect.
+// a range dirty on both sides takes the contents of the side synced last.
+template < typename T >
+class MirroredBuffer
+{
+  static_assert( std::is_trivially_copyable< T >::value ,
+      "MirroredBuffer elements are copied bytewise" );
+
+protected:
+  // count rows of size bytes , stride bytes apart , starting at offset
+  struct run_t
+  {
+    size_t offset;
+    size_t size;
+    size_t stride;
+    size_t count;
+  };
+
+  CommandQueue queue_;
+  std::vector< T > host_;
+  Buffer device_;
+  detail::interval_set host_dirty_;
+  detail::interval_set device_dirty_;
+  size_t merge_gap_ = 4096 / sizeof(T);
+  // the last upload reads host_
+  detail::SharedEvent fence_;
+  size_t transfers_ = 0;
+
+  bool host_ready_( int* errp )
+  {
+    if( fence_ )
+    {
+      int err;
+      fence_.wait( &err );
+      EC_CHECK_ERROR( err , errp , return false )
+      fence_ = detail::SharedEvent();
+    }
+    return true;
+  }
+  // dirty ranges merged across clean gaps , in elements
+  std::vector< std::pair< size_t , size_t > > merged_( detail::interval_set const& dirty ,
+      detail::interval_set const& other ) const
+  {
+    std::vector< std::pair< size_t , size_t > > ret;
+    for( auto const& r : dirty )
+    {
+      if( !ret.empty() && r.first - ret.back().second <= merge_gap_ &&
+          !other.intersects( ret.back().second , r.first ) )
+      {
+        ret.back().second = r.second;
+      }
+      else
+      {
+        ret.emplace_back( r.first , r.second );
+      }
+    }
+    return ret;
+  }
+  std::vector< run_t > plan_( std::vector< std::pair< size_t , size_t > > const& ranges ) const
+  {
+    std::vector< run_t > ret;
+    for( size_t i=0; i<ranges.size(); )
+    {
+      const size_t size = ranges[i].second - ranges[i].first;
+      size_t j = i + 1;
+      if( j < ranges.size() && ranges[j].second - ranges[j].first == size )
+      {
+        const size_t stride = ranges[j].first - ranges[i].first;
+        while( j < ranges.size() && ranges[j].second - ranges[j].first == size &&
+            ranges[j].first - ranges[j-1].first == stride )
+        {
+          ++j;
+        }
+        if( j - i >= 3 )
+        {
+          ret.push_back( { ranges[i].first*sizeof(T) , size*sizeof(T) , stride*sizeof(T) , j - i } );
+          i = j;
+          continue;
+        }
+      }
+      ret.push_back( { ranges[i].first*sizeof(T) , size*sizeof(T) , 0 , 1 } );
+      ++i;
+    }
+    return ret;
+  }
+  Event transfer_( run_t const& run , bool to_device ,
+      detail::list_view<cl_event> const& events , int* errp )
+  {
+    ++transfers_;
+    char* ptr = reinterpret_cast< char* >( host_.data() );
+    if( run.count == 1 )
+    {
+      return to_device ?
+        queue_.write_buffer( device_ , CL_FALSE , run.offset , run.size , ptr + run.offset ,
+            events , errp ) :
+        queue_.read_buffer( device_ , CL_FALSE , run.offset , run.size , ptr + run.offset ,
+            events , errp );
+    }
+    // host_ mirrors the device layout , both sides use the same origin
+    const ImageOffset origin( run.offset % run.stride , run.offset / run.stride );
+    const ImageSize region( run.size , run.count );
+    const ImagePitch pitch( run.stride , run.count );
+    return to_device ?
+      queue_.write_buffer_rect( device_ , CL_FALSE , origin , origin , region , pitch , pitch ,
+          ptr , events , errp ) :
+      queue_.read_buffer_rect( device_ , CL_FALSE , origin , origin , region , pitch , pitch ,
+          ptr , events , errp );
+  }
+  Event sync_( std::vector< run_t > const& runs , bool to_device ,
+      detail::list_view<cl_event> const& events , int* errp )
+  {
+    std::vector< Event > issued;
+    std::vector< cl_event > done;
+    for( auto const& run : runs )
+    {
+      Event ev = transfer_( run , to_device , events , errp );
+      if( !ev )
+      {
+        return {};
+      }
+      done.push_back( ev.get() );
+      issued.push_back( std::move( ev ) );
+    }
+    if( issued.size() == 1 )
+    {
+      return std::move( issued.front() );
+    }
+    return queue_.marker( done , errp );
+  }
+
+public:
+  // the host copy is zero-initialized and fully dirty , so the first
+  // sync_to_device() initializes the device buffer
+  MirroredBuffer( CommandQueue queue , size_t n ,
+      cl_mem_flags flags=CL_MEM_READ_WRITE ,
+      int* errp=nullptr )
+    : queue_( std::move( queue ) ) ,
+      host_( n )
+  {
+    device_ = Buffer( queue_.context( errp ) , flags , std::max< size_t >( n , 1 ) * sizeof(T) ,
+        nullptr , errp );
+    host_dirty_.insert( 0 , n );
+  }
+  MirroredBuffer( MirroredBuffer const& ) = delete;
+  MirroredBuffer& operator=( MirroredBuffer const& ) = delete;
+  ~MirroredBuffer()
+  {
+    // host_ may still be read by the last upload
+    const cl_event fence = fence_.get();
+    if( fence )
+    {
+      clWaitForEvents( 1 , &fence );
+    }
+  }
+
+  size_t size() const
+  {
+    return host_.size();
+  }
+  Buffer const& buffer() const
+  {
+    return device_;
+  }
+  CommandQueue const& queue() const
+  {
+    return queue_;
+  }
+
+  // host copy , as of the last sync plus host-side changes
+  T const* data() const
+  {
+    return host_.data();
+  }
+  T const& operator[]( size_t i ) const
+  {
+    return host_[i];
+  }
+  // writable host range , marked dirty
+  T* modify( size_t first , size_t count , int* errp=nullptr )
+  {
+    if( !host_ready_( errp ) )
+    {
+      return nullptr;
+    }
+    host_dirty_.insert( first , first + count );
+    EC_SET_ERRP( errp )
+    return host_.data() + first;
+  }
+  void write( size_t first , T const* data , size_t count , int* errp=nullptr )
+  {
+    T* ptr = modify( first , count , errp );
+    if( ptr )
+    {
+      std::copy( data , data + count , ptr );
+    }
+  }
+  void mark_host_dirty( size_t first , size_t count )
+  {
+    host_dirty_.insert( first , first + count );
+  }
+  // declares a device-side write , e.g. the output range of a kernel
+  void mark_device_dirty( size_t first , size_t count )
+  {
+    device_dirty_.insert( first , first + count );
+  }
+
+  // elements not synced yet
+  size_t host_dirty() const
+  {
+    return host_dirty_.covered();
+  }
+  size_t device_dirty() const
+  {
+    return device_dirty_.covered();
+  }
+  // in elements
+  size_t merge_gap() const
+  {
+    return merge_gap_;
+  }
+  void set_merge_gap( size_t elements )
+  {
+    merge_gap_ = elements;
+  }
+  // transfer commands issued so far
+  size_t transfers() const
+  {
+    return transfers_;
+  }
+
+  // host_ must not change until the returned event completed; modify()
+  // and write() wait for it
+  Event sync_to_device( detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr )
+  {
+    if( host_dirty_.empty() )
+    {
+      EC_SET_ERRP( errp )
+      return {};
+    }
+    if( !host_ready_( errp ) )
+    {
+      return {};
+    }
+    const auto ranges = merged_( host_dirty_ , device_dirty_ );
+    Event ret = sync_( plan_( ranges ) , true , events , errp );
+    if( !ret )
+    {
+      return {};
+    }
+    for( auto const& r : ranges )
+    {
+      device_dirty_.erase( r.first , r.second );
+    }
+    host_dirty_.clear();
+    fence_ = ret.share();
+    return ret;
+  }
+  // blocking; events are typically the kernels that wrote the ranges
+  void sync_to_host( detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr )
+  {
+    if( device_dirty_.empty() )
+    {
+      EC_SET_ERRP( errp )
+      return;
+    }
+    if( !host_ready_( errp ) )
+    {
+      return;
+    }
+    const auto ranges = merged_( device_dirty_ , host_dirty_ );
+    Event done = sync_( plan_( ranges ) , false , events , errp );
+    if( !done )
+    {
+      return;
+    }
+    int err;
+    done.wait( &err );
+    EC_CHECK_ERROR( err , errp , return )
+    for( auto const& r : ranges )
+    {
+      host_dirty_.erase( r.first , r.second );
+    }
+    device_dirty_.clear();
+    EC_SET_ERRP( errp )
+  }
+};
+
+}
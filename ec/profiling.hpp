@@ -0,0 +1,439 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "event.hpp"
+#include "kernel.hpp"
+#include "command_queue.hpp"
+#include "ndrange.hpp"
+#include "list_view.hpp"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ec { namespace detail
+{
+
+inline const char* command_type_string( cl_command_type type )
+{
+  switch( type )
+  {
+    case CL_COMMAND_NDRANGE_KERNEL:       return "ndrange";
+    case CL_COMMAND_TASK:                 return "task";
+    case CL_COMMAND_NATIVE_KERNEL:        return "native_kernel";
+    case CL_COMMAND_READ_BUFFER:          return "read_buffer";
+    case CL_COMMAND_WRITE_BUFFER:         return "write_buffer";
+    case CL_COMMAND_COPY_BUFFER:          return "copy_buffer";
+    case CL_COMMAND_READ_IMAGE:           return "read_image";
+    case CL_COMMAND_WRITE_IMAGE:          return "write_image";
+    case CL_COMMAND_COPY_IMAGE:           return "copy_image";
+    case CL_COMMAND_COPY_IMAGE_TO_BUFFER: return "copy_image_to_buffer";
+    case CL_COMMAND_COPY_BUFFER_TO_IMAGE: return "copy_buffer_to_image";
+    case CL_COMMAND_MAP_BUFFER:           return "map_buffer";
+    case CL_COMMAND_MAP_IMAGE:            return "map_image";
+    case CL_COMMAND_UNMAP_MEM_OBJECT:     return "unmap";
+    case CL_COMMAND_MARKER:               return "marker";
+    case CL_COMMAND_READ_BUFFER_RECT:     return "read_buffer_rect";
+    case CL_COMMAND_WRITE_BUFFER_RECT:    return "write_buffer_rect";
+    case CL_COMMAND_COPY_BUFFER_RECT:     return "copy_buffer_rect";
+    case CL_COMMAND_USER:                 return "user";
+    case CL_COMMAND_BARRIER:              return "barrier";
+    case CL_COMMAND_MIGRATE_MEM_OBJECTS:  return "migrate_mem_objects";
+    case CL_COMMAND_FILL_BUFFER:          return "fill_buffer";
+    case CL_COMMAND_FILL_IMAGE:           return "fill_image";
+  }
+  return "unknown";
+}
+
+}}
+
+namespace ec
+{
+
+// log-linear latency histogram ( HDR style ).
+// each power of two is split into 2^sub_bits linear buckets ,
+// so every recorded value keeps ~3% relative precision.
+// record() is lock-free and may be called from driver callback threads.
+class LatencyHistogram
+{
+public:
+  constexpr static unsigned sub_bits = 5;
+  constexpr static size_t sub_count = size_t(1) << sub_bits;
+  constexpr static size_t bucket_count = ( 64 - sub_bits + 1 ) * sub_count;
+
+protected:
+  std::atomic< cl_ulong > counts_[ bucket_count ];
+  std::atomic< cl_ulong > total_;
+  std::atomic< cl_ulong > sum_;
+  std::atomic< cl_ulong > min_;
+  std::atomic< cl_ulong > max_;
+
+  static unsigned msb_( cl_ulong v )
+  {
+    unsigned ret = 0;
+    for( unsigned step = 32; step > 0; step >>= 1 )
+    {
+      if( v >> step )
+      {
+        v >>= step;
+        ret += step;
+      }
+    }
+    return ret;
+  }
+  static size_t index_( cl_ulong v )
+  {
+    if( v < sub_count )
+    {
+      return static_cast< size_t >( v );
+    }
+    const unsigned shift = msb_( v ) - sub_bits;
+    return ( shift + 1 )*sub_count + static_cast< size_t >( ( v >> shift ) - sub_count );
+  }
+  // highest value that lands in bucket idx
+  static cl_ulong highest_( size_t idx )
+  {
+    if( idx < sub_count )
+    {
+      return idx;
+    }
+    const unsigned shift = static_cast< unsigned >( idx/sub_count - 1 );
+    const cl_ulong sub = idx%sub_count + sub_count;
+    return ( ( sub + 1 ) << shift ) - 1;
+  }
+
+public:
+  LatencyHistogram()
+  {
+    reset();
+  }
+  LatencyHistogram( LatencyHistogram const& ) = delete;
+  LatencyHistogram& operator=( LatencyHistogram const& ) = delete;
+
+  void reset()
+  {
+    for( auto& c : counts_ )
+    {
+      c.store( 0 , std::memory_order_relaxed );
+    }
+    total_.store( 0 , std::memory_order_relaxed );
+    sum_.store( 0 , std::memory_order_relaxed );
+    min_.store( ~cl_ulong(0) , std::memory_order_relaxed );
+    max_.store( 0 , std::memory_order_relaxed );
+  }
+  void record( cl_ulong v )
+  {
+    counts_[ index_( v ) ].fetch_add( 1 , std::memory_order_relaxed );
+    total_.fetch_add( 1 , std::memory_order_relaxed );
+    sum_.fetch_add( v , std::memory_order_relaxed );
+    cl_ulong cur = min_.load( std::memory_order_relaxed );
+    while( v < cur &&
+        !min_.compare_exchange_weak( cur , v , std::memory_order_relaxed ) )
+    {
+    }
+    cur = max_.load( std::memory_order_relaxed );
+    while( v > cur &&
+        !max_.compare_exchange_weak( cur , v , std::memory_order_relaxed ) )
+    {
+    }
+  }
+
+  cl_ulong count() const
+  {
+    return total_.load( std::memory_order_relaxed );
+  }
+  cl_ulong min() const
+  {
+    return count() ? min_.load( std::memory_order_relaxed ) : 0;
+  }
+  cl_ulong max() const
+  {
+    return max_.load( std::memory_order_relaxed );
+  }
+  double mean() const
+  {
+    const cl_ulong n = count();
+    return n ? static_cast< double >( sum_.load( std::memory_order_relaxed ) ) / n : 0.0;
+  }
+  // p in [0,1]; returns the upper bound of the bucket holding the p-quantile
+  cl_ulong percentile( double p ) const
+  {
+    const cl_ulong n = count();
+    if( n == 0 )
+    {
+      return 0;
+    }
+    cl_ulong target = static_cast< cl_ulong >( p*n + 0.5 );
+    if( target == 0 ) { target = 1; }
+    if( target > n ) { target = n; }
+    cl_ulong seen = 0;
+    for( size_t i=0; i<bucket_count; ++i )
+    {
+      seen += counts_[i].load( std::memory_order_relaxed );
+      if( seen >= target )
+      {
+        const cl_ulong hi = highest_( i );
+        return hi < max() ? hi : max();
+      }
+    }
+    return max();
+  }
+};
+
+// latency of one kernel or one command type , in nanoseconds
+struct ProfilingStats
+{
+  LatencyHistogram queue_wait; // START - QUEUED
+  LatencyHistogram execution;  // END - START
+};
+
+struct ProfilingSummary
+{
+  std::string name;
+  cl_ulong count;
+  cl_ulong queue_wait_p50;
+  cl_ulong queue_wait_p99;
+  cl_ulong execution_p50;
+  cl_ulong execution_p99;
+};
+
+// harvests QUEUED/START/END timestamps of tracked events asynchronously
+// through EventBase::set_callback , and aggregates them per kernel name
+// and per command type. nothing on the enqueue path waits for the device.
+// the attached queue must be created with CommandQueue::PROFILING.
+class ProfilingCollector
+{
+  struct pending_t
+  {
+    ProfilingCollector* self;
+    ProfilingStats* by_name;
+    ProfilingStats* by_type;
+  };
+
+  CommandQueue queue_;
+  mutable std::mutex mutex_;
+  std::map< std::string , std::unique_ptr< ProfilingStats > > names_;
+  std::map< cl_command_type , std::unique_ptr< ProfilingStats > > types_;
+  std::map< cl_kernel , std::pair< Kernel , ProfilingStats* > > kernels_;
+  std::atomic< size_t > pending_;
+  std::atomic< size_t > dropped_;
+
+  static void callback_( cl_event event , cl_int status , void* userdata )
+  {
+    pending_t* p = static_cast< pending_t* >( userdata );
+    ProfilingCollector* self = p->self;
+    cl_ulong queued , start , end;
+    const bool ok = status == CL_COMPLETE &&
+      clGetEventProfilingInfo( event , CL_PROFILING_COMMAND_QUEUED ,
+          sizeof(queued) , &queued , nullptr ) == CL_SUCCESS &&
+      clGetEventProfilingInfo( event , CL_PROFILING_COMMAND_START ,
+          sizeof(start) , &start , nullptr ) == CL_SUCCESS &&
+      clGetEventProfilingInfo( event , CL_PROFILING_COMMAND_END ,
+          sizeof(end) , &end , nullptr ) == CL_SUCCESS;
+    if( ok )
+    {
+      const cl_ulong wait = start > queued ? start - queued : 0;
+      const cl_ulong exec = end > start ? end - start : 0;
+      for( ProfilingStats* s : { p->by_name , p->by_type } )
+      {
+        if( s )
+        {
+          s->queue_wait.record( wait );
+          s->execution.record( exec );
+        }
+      }
+    }
+    else
+    {
+      self->dropped_.fetch_add( 1 , std::memory_order_relaxed );
+    }
+    delete p;
+    self->pending_.fetch_sub( 1 , std::memory_order_release );
+  }
+
+  // caller holds mutex_
+  ProfilingStats* name_stats_( std::string const& name )
+  {
+    auto& ret = names_[ name ];
+    if( !ret )
+    {
+      ret.reset( new ProfilingStats );
+    }
+    return ret.get();
+  }
+  // caller holds mutex_
+  ProfilingStats* type_stats_( cl_command_type type )
+  {
+    auto& ret = types_[ type ];
+    if( !ret )
+    {
+      ret.reset( new ProfilingStats );
+    }
+    return ret.get();
+  }
+  void track_( cl_event event , ProfilingStats* by_name , ProfilingStats* by_type ,
+      int* errp )
+  {
+    pending_t* p = new pending_t{ this , by_name , by_type };
+    pending_.fetch_add( 1 , std::memory_order_relaxed );
+    const int err = clSetEventCallback( event , CL_COMPLETE , callback_ , p );
+    if( err != CL_SUCCESS )
+    {
+      delete p;
+      pending_.fetch_sub( 1 , std::memory_order_relaxed );
+    }
+    EC_CHECK_ERROR( err , errp , return )
+    EC_SET_ERRP( errp )
+  }
+  static ProfilingSummary summarize_( std::string name , ProfilingStats const& s )
+  {
+    return { std::move( name ) ,
+      s.execution.count() ,
+      s.queue_wait.percentile( 0.50 ) , s.queue_wait.percentile( 0.99 ) ,
+      s.execution.percentile( 0.50 ) , s.execution.percentile( 0.99 ) };
+  }
+
+public:
+  ProfilingCollector( CommandQueue queue )
+    : queue_( std::move( queue ) ) ,
+      pending_( 0 ) ,
+      dropped_( 0 )
+  {
+  }
+  // drains the queue so no callback can outlive the collector
+  ~ProfilingCollector()
+  {
+    if( queue_ )
+    {
+      queue_.finish();
+    }
+    while( pending_.load( std::memory_order_acquire ) != 0 )
+    {
+      std::this_thread::yield();
+    }
+  }
+  ProfilingCollector( ProfilingCollector const& ) = delete;
+  ProfilingCollector& operator=( ProfilingCollector const& ) = delete;
+
+  CommandQueue const& queue() const
+  {
+    return queue_;
+  }
+
+  // aggregate event under its command type , and under name if given
+  void track( cl_event event , const char* name=nullptr , int* errp=nullptr )
+  {
+    const cl_command_type type = detail::ShellEvent( event ).command_type( errp );
+    ProfilingStats* by_name;
+    ProfilingStats* by_type;
+    {
+      std::lock_guard< std::mutex > lock( mutex_ );
+      by_name = name ? name_stats_( name ) : nullptr;
+      by_type = type_stats_( type );
+    }
+    track_( event , by_name , by_type , errp );
+  }
+  // aggregate event under its command type and under Kernel::name() of
+  // kernel; names are cached per kernel
+  void track( cl_event event , cl_kernel kernel , int* errp=nullptr )
+  {
+    const cl_command_type type = detail::ShellEvent( event ).command_type( errp );
+    ProfilingStats* by_name;
+    ProfilingStats* by_type;
+    {
+      std::lock_guard< std::mutex > lock( mutex_ );
+      auto it = kernels_.find( kernel );
+      if( it == kernels_.end() )
+      {
+        Kernel k( kernel );
+        const std::string name = k.name().c_str();
+        it = kernels_.emplace( kernel ,
+            std::make_pair( std::move( k ) , name_stats_( name ) ) ).first;
+      }
+      by_name = it->second.second;
+      by_type = type_stats_( type );
+    }
+    track_( event , by_name , by_type , errp );
+  }
+
+  Event ndrange( cl_kernel kernel ,
+      NDRange const& global_offsets ,
+      NDRange const& global_size ,
+      NDRange const& local_size ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr )
+  {
+    Event ret = queue_.ndrange( kernel , global_offsets , global_size , local_size ,
+        events , errp );
+    if( ret )
+    {
+      track( ret , kernel , errp );
+    }
+    return ret;
+  }
+  Event task( cl_kernel kernel ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr )
+  {
+    Event ret = queue_.task( kernel , events , errp );
+    if( ret )
+    {
+      track( ret , kernel , errp );
+    }
+    return ret;
+  }
+
+  // events whose callback has not fired yet
+  size_t pending() const
+  {
+    return pending_.load( std::memory_order_acquire );
+  }
+  // events that failed or had no profiling info
+  size_t dropped() const
+  {
+    return dropped_.load( std::memory_order_relaxed );
+  }
+
+  // stats of one kernel ( or track() name ); nullptr if never seen
+  ProfilingStats const* stats( std::string const& name ) const
+  {
+    std::lock_guard< std::mutex > lock( mutex_ );
+    auto it = names_.find( name );
+    return it == names_.end() ? nullptr : it->second.get();
+  }
+  ProfilingStats const* stats( cl_command_type type ) const
+  {
+    std::lock_guard< std::mutex > lock( mutex_ );
+    auto it = types_.find( type );
+    return it == types_.end() ? nullptr : it->second.get();
+  }
+
+  std::vector< ProfilingSummary > kernels() const
+  {
+    std::lock_guard< std::mutex > lock( mutex_ );
+    std::vector< ProfilingSummary > ret;
+    ret.reserve( names_.size() );
+    for( auto const& n : names_ )
+    {
+      ret.push_back( summarize_( n.first , *n.second ) );
+    }
+    return ret;
+  }
+  std::vector< ProfilingSummary > command_types() const
+  {
+    std::lock_guard< std::mutex > lock( mutex_ );
+    std::vector< ProfilingSummary > ret;
+    ret.reserve( types_.size() );
+    for( auto const& t : types_ )
+    {
+      ret.push_back( summarize_( detail::command_type_string( t.first ) , *t.second ) );
+    }
+    return ret;
+  }
+};
+
+}
@@ -53,6 +53,31 @@ public:
     EC_SET_ERRP( errp )
     data_ = ret;
   }
+  // one binary per device , as returned by binaries(); still needs build()
+  Program( cl_context context ,
+      detail::list_view<cl_device_id> const& devices ,
+      detail::list_view<size_t> const& sizes ,
+      detail::list_view<const unsigned char*> const& binaries ,
+      int* errp=nullptr )
+  {
+    int err;
+    std::vector< cl_int > status( devices.size() );
+    cl_program ret = clCreateProgramWithBinary( context ,
+        devices.size() , devices.data() , sizes.data() ,
+        const_cast< const unsigned char** >( binaries.data() ) ,
+        status.data() , &err );
+    for( size_t i=0; i<status.size() && err == CL_SUCCESS; ++i )
+    {
+      err = status[i];
+    }
+    if( err != CL_SUCCESS && ret != NULL )
+    {
+      clReleaseProgram( ret );
+    }
+    EC_CHECK_ERROR( err , errp , data_=NULL;return )
+    EC_SET_ERRP( errp )
+    data_ = ret;
+  }
   ~Program()
   {
     release_if();
@@ -217,6 +242,29 @@ public:
   {
     return get_info_string_( CL_PROGRAM_KERNEL_NAMES , errp );
   }
+  std::vector<size_t> binary_sizes( int* errp=nullptr ) const
+  {
+    return get_info_raw_< size_t >( CL_PROGRAM_BINARY_SIZES , errp );
+  }
+  // in the order of devices(); empty for devices the program is not built for
+  std::vector< std::vector<unsigned char> > binaries( int* errp=nullptr ) const
+  {
+    int err;
+    const std::vector<size_t> sizes = binary_sizes( &err );
+    EC_CHECK_ERROR( err , errp , return {} )
+    std::vector< std::vector<unsigned char> > ret( sizes.size() );
+    std::vector< unsigned char* > ptrs( sizes.size() );
+    for( size_t i=0; i<sizes.size(); ++i )
+    {
+      ret[i].resize( sizes[i] );
+      ptrs[i] = sizes[i] == 0 ? nullptr : ret[i].data();
+    }
+    err = clGetProgramInfo( get() , CL_PROGRAM_BINARIES ,
+        ptrs.size() * sizeof(unsigned char*) , ptrs.data() , nullptr );
+    EC_CHECK_ERROR( err , errp , return {} )
+    EC_SET_ERRP( errp )
+    return ret;
+  }
 };
 
 inline void swap( Program& l , Program& r )
@@ -0,0 +1,273 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "definitions.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <direct.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ec
+{
+
+namespace detail
+{
+
+constexpr char program_cache_magic_[8] = { 'E' , 'C' , 'P' , 'R' , 'O' , 'G' , 0 , 1 };
+
+struct program_cache_header_
+{
+  char magic[8];
+  // second hash of the key , guards against collisions of the file name
+  uint64_t check;
+  uint64_t size;
+};
+
+// fnv-1a over length-prefixed fields
+class program_cache_hash_
+{
+  uint64_t state_;
+
+  void bytes_( void const* data , size_t size )
+  {
+    const unsigned char* p = static_cast< const unsigned char* >( data );
+    for( size_t i=0; i<size; ++i )
+    {
+      state_ = ( state_ ^ p[i] ) * 0x100000001b3ull;
+    }
+  }
+
+public:
+  explicit program_cache_hash_( uint64_t basis )
+    : state_( basis )
+  {
+  }
+  program_cache_hash_& operator<<( std::string const& field )
+  {
+    const uint64_t size = field.size();
+    bytes_( &size , sizeof(size) );
+    bytes_( field.data() , field.size() );
+    return *this;
+  }
+  uint64_t value() const
+  {
+    return state_;
+  }
+};
+
+}
+
+// program binaries kept in a directory across processes. the key hashes the
+// source , the build options , the device name and the driver and platform
+// versions , so a driver update or a changed option rebuilds from source.
+// files are written under a unique name and renamed into place , so
+// processes sharing the directory never see a partial binary; a binary the
+// runtime rejects is rebuilt from source and replaced
+class ProgramCache
+{
+protected:
+  std::string directory_;
+  std::atomic< size_t > hits_{ 0 };
+  std::atomic< size_t > misses_{ 0 };
+  std::atomic< double > last_seconds_{ 0 };
+
+  struct key_t
+  {
+    std::string path;
+    uint64_t check;
+  };
+
+  key_t key_( cl_device_id device , std::string const& source , const char* options ,
+      int* errp ) const
+  {
+    const Device dev( device );
+    const std::string name = dev.get_info< CL_DEVICE_NAME >( errp );
+    const std::string driver = dev.get_info< CL_DRIVER_VERSION >( errp );
+    const std::string platform = dev.get_info< CL_DEVICE_PLATFORM >( errp ).version( errp );
+    detail::program_cache_hash_ name_hash( 0xcbf29ce484222325ull );
+    detail::program_cache_hash_ check_hash( 0x84222325cbf29ce4ull );
+    for( auto* h : { &name_hash , &check_hash } )
+    {
+      *h << source << std::string( options ? options : "" ) << name << driver << platform;
+    }
+    char file[32];
+    std::snprintf( file , sizeof(file) , "%016llx.bin" ,
+        static_cast< unsigned long long >( name_hash.value() ) );
+    return { directory_ + "/" + file , check_hash.value() };
+  }
+
+  static std::vector< unsigned char > load_( key_t const& key )
+  {
+    std::ifstream in( key.path , std::ios::binary );
+    detail::program_cache_header_ header;
+    if( !in.read( reinterpret_cast< char* >( &header ) , sizeof(header) ) ||
+        std::memcmp( header.magic , detail::program_cache_magic_ , sizeof(header.magic) ) != 0 ||
+        header.check != key.check || header.size == 0 )
+    {
+      return {};
+    }
+    std::vector< unsigned char > ret( static_cast< size_t >( header.size ) );
+    if( !in.read( reinterpret_cast< char* >( ret.data() ) , ret.size() ) )
+    {
+      return {};
+    }
+    return ret;
+  }
+
+  // best effort; a failed store only costs the next process a build
+  void store_( key_t const& key , std::vector< unsigned char > const& binary ) const
+  {
+    static std::atomic< unsigned > counter{ 0 };
+#if defined(_WIN32)
+    _mkdir( directory_.c_str() );
+    const long pid = _getpid();
+#else
+    ::mkdir( directory_.c_str() , 0755 );
+    const long pid = ::getpid();
+#endif
+    const std::string temp = key.path + "." + std::to_string( pid ) + "." +
+      std::to_string( counter++ ) + ".tmp";
+    detail::program_cache_header_ header;
+    std::memcpy( header.magic , detail::program_cache_magic_ , sizeof(header.magic) );
+    header.check = key.check;
+    header.size = binary.size();
+    {
+      std::ofstream out( temp , std::ios::binary | std::ios::trunc );
+      out.write( reinterpret_cast< char const* >( &header ) , sizeof(header) );
+      out.write( reinterpret_cast< char const* >( binary.data() ) , binary.size() );
+      if( !out.flush() )
+      {
+        out.close();
+        std::remove( temp.c_str() );
+        return;
+      }
+    }
+    // atomic on POSIX; where rename does not replace , the first writer wins
+    if( std::rename( temp.c_str() , key.path.c_str() ) != 0 )
+    {
+      std::remove( temp.c_str() );
+    }
+  }
+
+  // empty when the runtime rejects binary
+  static Program from_binary_( cl_context context , cl_device_id device ,
+      std::vector< unsigned char > const& binary , const char* options )
+  {
+    const size_t size = binary.size();
+    const unsigned char* data = binary.data();
+    cl_int status;
+    cl_int err;
+    // raw calls , a stale binary is not an error
+    const cl_program ret = clCreateProgramWithBinary( context , 1 , &device ,
+        &size , &data , &status , &err );
+    if( err != CL_SUCCESS || status != CL_SUCCESS )
+    {
+      if( ret != NULL )
+      {
+        clReleaseProgram( ret );
+      }
+      return {};
+    }
+    Program program( ret , no_retain_t() );
+    if( clBuildProgram( program , 1 , &device , options , nullptr , nullptr ) != CL_SUCCESS )
+    {
+      return {};
+    }
+    return program;
+  }
+
+public:
+  // directory is created on the first store if missing , not its parents
+  explicit ProgramCache( std::string directory )
+    : directory_( std::move( directory ) )
+  {
+  }
+  ProgramCache( ProgramCache const& ) = delete;
+  ProgramCache& operator=( ProgramCache const& ) = delete;
+
+  std::string const& directory() const
+  {
+    return directory_;
+  }
+  size_t hits() const
+  {
+    return hits_;
+  }
+  size_t misses() const
+  {
+    return misses_;
+  }
+  // seconds the last build() took , to compare cold and warm starts
+  double last_seconds() const
+  {
+    return last_seconds_;
+  }
+
+  // built program for source on device , from the cache when possible.
+  // on a miss it is built from source and its binary stored
+  Program build( cl_context context , cl_device_id device ,
+      std::string const& source , const char* options=nullptr ,
+      int* errp=nullptr )
+  {
+    const auto begin = std::chrono::steady_clock::now();
+    int err;
+    const key_t key = key_( device , source , options , &err );
+    EC_CHECK_ERROR( err , errp , return {} )
+
+    const std::vector< unsigned char > cached = load_( key );
+    if( !cached.empty() )
+    {
+      Program program = from_binary_( context , device , cached , options );
+      if( program )
+      {
+        ++hits_;
+        const std::chrono::duration< double > took = std::chrono::steady_clock::now() - begin;
+        last_seconds_ = took.count();
+        EC_SET_ERRP( errp )
+        return program;
+      }
+    }
+
+    ++misses_;
+    const char* text = source.c_str();
+    const size_t size = source.size();
+    Program program( context , text , size , errp );
+    if( !program )
+    {
+      return {};
+    }
+    // the program comes back on failure too , for its build_log()
+    program.build( device , options , nullptr , nullptr , &err );
+    EC_CHECK_ERROR( err , errp , return program )
+    // a program from source has a binary slot per device of the context
+    const std::vector< Device > devices = program.devices( &err );
+    const std::vector< std::vector< unsigned char > > binaries = program.binaries( &err );
+    for( size_t i=0; i<devices.size() && i<binaries.size(); ++i )
+    {
+      if( devices[i].get() == device && !binaries[i].empty() )
+      {
+        store_( key , binaries[i] );
+        break;
+      }
+    }
+    const std::chrono::duration< double > took = std::chrono::steady_clock::now() - begin;
+    last_seconds_ = took.count();
+    EC_SET_ERRP( errp )
+    return program;
+  }
+};
+
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "event.hpp"
+#include "memory.hpp"
+#include "command_queue.hpp"
+#include "ndrange.hpp"
+#include "list_view.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace ec
+{
+
+// one entry of a command's read or write set , in bytes of mem.
+// size npos means "to the end of mem".
+struct Access
+{
+  constexpr static size_t npos = SIZE_MAX;
+
+  cl_mem mem;
+  size_t offset;
+  size_t size;
+  bool write;
+};
+inline Access reads( cl_mem mem , size_t offset=0 , size_t size=Access::npos )
+{
+  return { mem , offset , size , false };
+}
+inline Access writes( cl_mem mem , size_t offset=0 , size_t size=Access::npos )
+{
+  return { mem , offset , size , true };
+}
+
+// opt-in dependency inference for out-of-order queues.
+// every command declares what it reads and writes; the scheduler keeps ,
+// per buffer , the byte ranges touched by commands still relevant for
+// ordering , and waits only on RAW , WAR and WAW hazards.
+// sub-buffers are mapped onto their parent's byte range , so two disjoint
+// sub_buffer() regions of one allocation never wait on each other.
+class HazardScheduler
+{
+protected:
+  struct range_t
+  {
+    size_t begin;
+    size_t end;
+    detail::SharedEvent event;
+    bool write;
+  };
+
+  CommandQueue queue_;
+  std::map< cl_mem , std::vector< range_t > > buffers_;
+  std::vector< cl_event > wait_;
+  size_t commands_ = 0;
+  size_t dependencies_ = 0;
+
+  // completed ranges are dropped once a buffer tracks this many
+  constexpr static size_t prune_threshold = 64;
+
+  struct resolved_t
+  {
+    cl_mem root;
+    size_t begin;
+    size_t end;
+  };
+  static resolved_t resolve_( Access const& a )
+  {
+    cl_mem root = a.mem;
+    size_t base = 0;
+    size_t end = Access::npos;
+    cl_mem parent = NULL;
+    cl_mem_object_type type = 0;
+    clGetMemObjectInfo( a.mem , CL_MEM_ASSOCIATED_MEMOBJECT ,
+        sizeof(parent) , &parent , nullptr );
+    if( parent != NULL )
+    {
+      clGetMemObjectInfo( a.mem , CL_MEM_TYPE , sizeof(type) , &type , nullptr );
+    }
+    if( type == CL_MEM_OBJECT_BUFFER )
+    {
+      size_t size = 0;
+      clGetMemObjectInfo( a.mem , CL_MEM_OFFSET , sizeof(base) , &base , nullptr );
+      clGetMemObjectInfo( a.mem , CL_MEM_SIZE , sizeof(size) , &size , nullptr );
+      end = base + size;
+      root = parent;
+    }
+    const size_t begin = base + a.offset;
+    if( a.size != Access::npos )
+    {
+      end = std::min( end , begin + a.size );
+    }
+    return { root , begin , end };
+  }
+
+  void add_wait_( cl_event event )
+  {
+    if( std::find( wait_.begin() , wait_.end() , event ) == wait_.end() )
+    {
+      wait_.push_back( event );
+    }
+  }
+  static void prune_( std::vector< range_t >& ranges )
+  {
+    if( ranges.size() < prune_threshold )
+    {
+      return;
+    }
+    ranges.erase( std::remove_if( ranges.begin() , ranges.end() ,
+          []( range_t const& r )
+          {
+            return r.event.execution_status() == CL_COMPLETE;
+          } ) , ranges.end() );
+  }
+  // ranges still live after a write to [begin,end) supersedes them
+  static void subtract_( std::vector< range_t >& ranges , size_t begin , size_t end )
+  {
+    std::vector< range_t > rest;
+    for( auto& r : ranges )
+    {
+      if( r.end <= begin || r.begin >= end )
+      {
+        rest.push_back( std::move( r ) );
+        continue;
+      }
+      if( r.begin < begin )
+      {
+        rest.push_back( { r.begin , begin , r.event , r.write } );
+      }
+      if( r.end > end )
+      {
+        rest.push_back( { end , r.end , r.event , r.write } );
+      }
+    }
+    ranges.swap( rest );
+  }
+
+  void collect_( std::initializer_list< Access > accesses ,
+      detail::list_view<cl_event> const& events )
+  {
+    wait_.assign( events.data() , events.data() + events.size() );
+    for( Access const& a : accesses )
+    {
+      const resolved_t r = resolve_( a );
+      auto it = buffers_.find( r.root );
+      if( it == buffers_.end() )
+      {
+        continue;
+      }
+      for( range_t const& prev : it->second )
+      {
+        if( prev.end <= r.begin || prev.begin >= r.end )
+        {
+          continue;
+        }
+        // RAW , WAW , WAR
+        if( prev.write || a.write )
+        {
+          add_wait_( prev.event.get() );
+        }
+      }
+    }
+    dependencies_ += wait_.size() - events.size();
+  }
+  void commit_( std::initializer_list< Access > accesses , cl_event event )
+  {
+    ++commands_;
+    for( Access const& a : accesses )
+    {
+      const resolved_t r = resolve_( a );
+      auto& ranges = buffers_[ r.root ];
+      if( a.write )
+      {
+        subtract_( ranges , r.begin , r.end );
+      }
+      else
+      {
+        prune_( ranges );
+      }
+      ranges.push_back( { r.begin , r.end , detail::SharedEvent( event ) , a.write } );
+    }
+  }
+
+public:
+  HazardScheduler()
+  {
+  }
+  HazardScheduler( CommandQueue queue )
+    : queue_( std::move( queue ) )
+  {
+  }
+
+  CommandQueue const& queue() const
+  {
+    return queue_;
+  }
+
+  // enqueue( list_view<cl_event> const& wait ) must return the command's Event
+  template < typename F >
+  Event submit( std::initializer_list< Access > accesses , F&& enqueue ,
+      detail::list_view<cl_event> const& events=nullptr )
+  {
+    collect_( accesses , events );
+    Event ret = enqueue( detail::list_view<cl_event>( wait_.data() ,
+          static_cast< detail::size_type >( wait_.size() ) ) );
+    if( ret )
+    {
+      commit_( accesses , ret.get() );
+    }
+    return ret;
+  }
+
+  Event read_buffer( cl_mem buffer , size_t offset , size_t size , void* ptr ,
+      detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr )
+  {
+    return submit( { reads( buffer , offset , size ) } ,
+        [&]( detail::list_view<cl_event> const& wait )
+        {
+          return queue_.read_buffer( buffer , CL_FALSE , offset , size , ptr , wait , errp );
+        } , events );
+  }
+  Event write_buffer( cl_mem buffer , size_t offset , size_t size , void const* ptr ,
+      detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr )
+  {
+    return submit( { writes( buffer , offset , size ) } ,
+        [&]( detail::list_view<cl_event> const& wait )
+        {
+          return queue_.write_buffer( buffer , CL_FALSE , offset , size , ptr , wait , errp );
+        } , events );
+  }
+  Event copy_buffer( cl_mem src , cl_mem dst ,
+      size_t src_offset , size_t dst_offset , size_t size ,
+      detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr )
+  {
+    return submit( { reads( src , src_offset , size ) , writes( dst , dst_offset , size ) } ,
+        [&]( detail::list_view<cl_event> const& wait )
+        {
+          return queue_.copy_buffer( src , dst , src_offset , dst_offset , size , wait , errp );
+        } , events );
+  }
+  template < typename T >
+  Event fill_buffer( cl_mem buffer , T const& pattern ,
+      size_t offsetbytes , size_t count ,
+      detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr )
+  {
+    return submit( { writes( buffer , offsetbytes , sizeof(T)*count ) } ,
+        [&]( detail::list_view<cl_event> const& wait )
+        {
+          return queue_.fill_buffer( buffer , pattern , offsetbytes , count , wait , errp );
+        } , events );
+  }
+  Event ndrange( cl_kernel kernel ,
+      NDRange const& global_offsets ,
+      NDRange const& global_size ,
+      NDRange const& local_size ,
+      std::initializer_list< Access > accesses ,
+      detail::list_view<cl_event> const& events=nullptr ,
+      int* errp=nullptr )
+  {
+    return submit( accesses ,
+        [&]( detail::list_view<cl_event> const& wait )
+        {
+          return queue_.ndrange( kernel , global_offsets , global_size , local_size ,
+              wait , errp );
+        } , events );
+  }
+
+  // forget all tracked ranges , e.g. after queue().finish()
+  void reset()
+  {
+    buffers_.clear();
+  }
+  void finish()
+  {
+    queue_.finish();
+    reset();
+  }
+
+  size_t commands() const
+  {
+    return commands_;
+  }
+  // hazard edges inserted so far , excluding caller-supplied waits
+  size_t dependencies() const
+  {
+    return dependencies_;
+  }
+};
+
+}
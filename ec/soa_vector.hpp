@@ -0,0 +1,331 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "definitions.hpp"
+#include "buffer_create_type.hpp"
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 1 )
+#include <xmmintrin.h>
+#define EC_SOA_SSE
+#endif
+
+namespace ec
+{
+
+namespace detail
+{
+
+// byte offset of a member inside S
+template < typename S , typename T >
+size_t member_offset_( S const* s , T S::* member )
+{
+  return static_cast< size_t >( reinterpret_cast< char const* >( &( s->*member ) ) -
+      reinterpret_cast< char const* >( s ) );
+}
+
+// AoS <-> SoA for four 4-byte fields at offsets 0 , 4 , 8 , 12 of a 16-byte
+// struct , the xyzw layout; 4x4 register transposes , returns elements done
+inline size_t soa_transpose4_( char const* aos , size_t n , char* const* columns )
+{
+#ifdef EC_SOA_SSE
+  float* c0 = reinterpret_cast< float* >( columns[0] );
+  float* c1 = reinterpret_cast< float* >( columns[1] );
+  float* c2 = reinterpret_cast< float* >( columns[2] );
+  float* c3 = reinterpret_cast< float* >( columns[3] );
+  float const* src = reinterpret_cast< float const* >( aos );
+  size_t i = 0;
+  for( ; i+4<=n; i+=4 )
+  {
+    __m128 r0 = _mm_loadu_ps( src + 4*i );
+    __m128 r1 = _mm_loadu_ps( src + 4*i + 4 );
+    __m128 r2 = _mm_loadu_ps( src + 4*i + 8 );
+    __m128 r3 = _mm_loadu_ps( src + 4*i + 12 );
+    _MM_TRANSPOSE4_PS( r0 , r1 , r2 , r3 );
+    _mm_storeu_ps( c0 + i , r0 );
+    _mm_storeu_ps( c1 + i , r1 );
+    _mm_storeu_ps( c2 + i , r2 );
+    _mm_storeu_ps( c3 + i , r3 );
+  }
+  return i;
+#else
+  (void)aos; (void)n; (void)columns;
+  return 0;
+#endif
+}
+inline size_t aos_transpose4_( char* aos , size_t n , char const* const* columns )
+{
+#ifdef EC_SOA_SSE
+  float const* c0 = reinterpret_cast< float const* >( columns[0] );
+  float const* c1 = reinterpret_cast< float const* >( columns[1] );
+  float const* c2 = reinterpret_cast< float const* >( columns[2] );
+  float const* c3 = reinterpret_cast< float const* >( columns[3] );
+  float* dst = reinterpret_cast< float* >( aos );
+  size_t i = 0;
+  for( ; i+4<=n; i+=4 )
+  {
+    __m128 r0 = _mm_loadu_ps( c0 + i );
+    __m128 r1 = _mm_loadu_ps( c1 + i );
+    __m128 r2 = _mm_loadu_ps( c2 + i );
+    __m128 r3 = _mm_loadu_ps( c3 + i );
+    _MM_TRANSPOSE4_PS( r0 , r1 , r2 , r3 );
+    _mm_storeu_ps( dst + 4*i , r0 );
+    _mm_storeu_ps( dst + 4*i + 4 , r1 );
+    _mm_storeu_ps( dst + 4*i + 8 , r2 );
+    _mm_storeu_ps( dst + 4*i + 12 , r3 );
+  }
+  return i;
+#else
+  (void)aos; (void)n; (void)columns;
+  return 0;
+#endif
+}
+
+}
+
+// structure-of-arrays device container: one allocation , one column per
+// field , each column starting at a CL_DEVICE_MEM_BASE_ADDR_ALIGN boundary
+// and exposed as a sub-buffer for kernel arguments.
+// upload() / download() transpose between host AoS records and the columns.
+template < typename... Ts >
+class soa_vector
+{
+  static_assert( sizeof...(Ts) > 0 , "soa_vector needs at least one field" );
+
+public:
+  constexpr static size_t field_count = sizeof...(Ts);
+  template < size_t I >
+  using field_type = std::tuple_element_t< I , std::tuple< Ts... > >;
+
+protected:
+  CommandQueue queue_;
+  size_t size_;
+  size_t bytes_ = 0;
+  size_t offsets_[ field_count ];
+  Buffer buffer_;
+  Buffer fields_[ field_count ];
+  // host image of buffer_ , fenced by the last upload
+  std::vector< char > host_;
+  detail::SharedEvent fence_;
+
+  static size_t field_size_( size_t i )
+  {
+    const size_t sizes[] = { sizeof(Ts)... };
+    return sizes[i];
+  }
+  bool host_ready_( int* errp )
+  {
+    if( fence_ )
+    {
+      int err;
+      fence_.wait( &err );
+      EC_CHECK_ERROR( err , errp , return false )
+      fence_ = detail::SharedEvent();
+    }
+    host_.resize( bytes_ );
+    return true;
+  }
+
+  // tiles keep the records in cache while every column is written
+  constexpr static size_t tile_ = 256;
+
+  template < typename S , size_t... Is >
+  void to_columns_( S const* aos , size_t n , std::index_sequence< Is... > ,
+      Ts S::*... members )
+  {
+    char* columns[] = { host_.data() + offsets_[Is]... };
+    size_t done = 0;
+    if( field_count == 4 && sizeof(S) == 16 && n > 0 )
+    {
+      const size_t offs[] = { detail::member_offset_( aos , members )... };
+      const size_t sizes[] = { sizeof(Ts)... };
+      if( offs[0] == 0 && offs[1] == 4 && offs[2] == 8 && offs[3] == 12 &&
+          sizes[0] == 4 && sizes[1] == 4 && sizes[2] == 4 && sizes[3] == 4 )
+      {
+        done = detail::soa_transpose4_( reinterpret_cast< char const* >( aos ) , n , columns );
+      }
+    }
+    for( size_t begin=done; begin<n; begin+=tile_ )
+    {
+      const size_t end = std::min( n , begin + tile_ );
+      int expand[] = { ( [&]
+          {
+            Ts* column = reinterpret_cast< Ts* >( columns[Is] );
+            for( size_t i=begin; i<end; ++i )
+            {
+              column[i] = aos[i].*members;
+            }
+          }() , 0 )... };
+      (void)expand;
+    }
+  }
+  template < typename S , size_t... Is >
+  void from_columns_( S* aos , size_t n , std::index_sequence< Is... > ,
+      Ts S::*... members ) const
+  {
+    char const* columns[] = { host_.data() + offsets_[Is]... };
+    size_t done = 0;
+    if( field_count == 4 && sizeof(S) == 16 && n > 0 )
+    {
+      const size_t offs[] = { detail::member_offset_( static_cast< S const* >( aos ) , members )... };
+      const size_t sizes[] = { sizeof(Ts)... };
+      if( offs[0] == 0 && offs[1] == 4 && offs[2] == 8 && offs[3] == 12 &&
+          sizes[0] == 4 && sizes[1] == 4 && sizes[2] == 4 && sizes[3] == 4 )
+      {
+        done = detail::aos_transpose4_( reinterpret_cast< char* >( aos ) , n , columns );
+      }
+    }
+    for( size_t begin=done; begin<n; begin+=tile_ )
+    {
+      const size_t end = std::min( n , begin + tile_ );
+      int expand[] = { ( [&]
+          {
+            Ts const* column = reinterpret_cast< Ts const* >( columns[Is] );
+            for( size_t i=begin; i<end; ++i )
+            {
+              aos[i].*members = column[i];
+            }
+          }() , 0 )... };
+      (void)expand;
+    }
+  }
+
+public:
+  soa_vector( CommandQueue queue , size_t n ,
+      cl_mem_flags flags=CL_MEM_READ_WRITE ,
+      int* errp=nullptr )
+    : queue_( std::move( queue ) ) ,
+      size_( n )
+  {
+    // reported in bits
+    const cl_uint bits = queue_.device( errp ).get_info< CL_DEVICE_MEM_BASE_ADDR_ALIGN >( errp );
+    const size_t align = std::max< size_t >( bits / 8 , 1 );
+    for( size_t i=0; i<field_count; ++i )
+    {
+      offsets_[i] = bytes_;
+      bytes_ += ( std::max< size_t >( n * field_size_( i ) , 1 ) + align - 1 ) / align * align;
+    }
+    buffer_ = Buffer( queue_.context( errp ) , flags , bytes_ , nullptr , errp );
+    if( !buffer_ )
+    {
+      return;
+    }
+    for( size_t i=0; i<field_count; ++i )
+    {
+      fields_[i] = buffer_.sub_buffer( 0 ,
+          buffer_create_range( offsets_[i] , std::max< size_t >( n * field_size_( i ) , 1 ) ) ,
+          errp );
+    }
+  }
+  soa_vector( soa_vector const& ) = delete;
+  soa_vector& operator=( soa_vector const& ) = delete;
+  ~soa_vector()
+  {
+    // host_ may still be read by the last upload
+    const cl_event fence = fence_.get();
+    if( fence )
+    {
+      clWaitForEvents( 1 , &fence );
+    }
+  }
+
+  size_t size() const
+  {
+    return size_;
+  }
+  // the whole allocation
+  Buffer const& buffer() const
+  {
+    return buffer_;
+  }
+  // column I as a sub-buffer , e.g. kernel[0] = soa.field<0>().get()
+  template < size_t I >
+  Buffer const& field() const
+  {
+    return fields_[I];
+  }
+  // byte offset of column I inside buffer()
+  template < size_t I >
+  size_t offset() const
+  {
+    return offsets_[I];
+  }
+
+  // transposes n records into the columns and writes them; the records
+  // may be reused as soon as upload() returns.
+  // soa.upload( particles.data() , n , &particle::x , &particle::y , &particle::z );
+  template < typename S >
+  Event upload( S const* aos , size_t n , Ts S::*... members , int* errp=nullptr )
+  {
+    n = std::min( n , size_ );
+    if( n == 0 )
+    {
+      EC_SET_ERRP( errp )
+      return {};
+    }
+    if( !host_ready_( errp ) )
+    {
+      return {};
+    }
+    to_columns_( aos , n , std::index_sequence_for< Ts... >() , members... );
+    Event ret;
+    if( n == size_ )
+    {
+      ret = queue_.write_buffer( buffer_ , CL_FALSE , 0 , bytes_ , host_.data() , nullptr , errp );
+    }
+    else
+    {
+      // one write per column , joined by a marker
+      std::vector< Event > writes;
+      std::vector< cl_event > events;
+      for( size_t i=0; i<field_count; ++i )
+      {
+        writes.push_back( queue_.write_buffer( buffer_ , CL_FALSE , offsets_[i] ,
+              n * field_size_( i ) , host_.data() + offsets_[i] , nullptr , errp ) );
+        if( !writes.back() )
+        {
+          return {};
+        }
+        events.push_back( writes.back().get() );
+      }
+      ret = queue_.marker( events , errp );
+    }
+    if( ret )
+    {
+      fence_ = ret.share();
+    }
+    return ret;
+  }
+
+  // blocking read of the first n records back into AoS form
+  template < typename S >
+  void download( S* aos , size_t n , Ts S::*... members , int* errp=nullptr )
+  {
+    n = std::min( n , size_ );
+    if( n == 0 )
+    {
+      EC_SET_ERRP( errp )
+      return;
+    }
+    if( !host_ready_( errp ) )
+    {
+      return;
+    }
+    int err;
+    queue_.read_buffer( no_event , buffer_ , CL_TRUE , 0 , bytes_ , host_.data() ,
+        nullptr , &err );
+    EC_CHECK_ERROR( err , errp , return )
+    from_columns_( aos , n , std::index_sequence_for< Ts... >() , members... );
+    EC_SET_ERRP( errp )
+  }
+};
+
+}
+
+#undef EC_SOA_SSE
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "definitions.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace ec
+{
+
+// ring of CL_MEM_ALLOC_HOST_PTR buffers , mapped once for their lifetime.
+// drivers back such buffers with page-locked memory , so a transfer from or
+// to a slot needs no bounce copy on the driver side.
+// each slot remembers the event of its last transfer and is only
+// overwritten after that event completed.
+// used by CommandQueue::upload() / download(); not thread-safe.
+class StagingPool
+{
+  friend class CommandQueue;
+protected:
+  struct slot_t
+  {
+    Buffer buffer;
+    void* ptr;
+    detail::SharedEvent fence;
+  };
+
+  CommandQueue queue_;
+  size_t slot_size_;
+  std::vector< slot_t > slots_;
+  size_t next_ = 0;
+  size_t stalls_ = 0;
+
+  // next slot , once its previous transfer completed
+  slot_t* acquire_( int* errp )
+  {
+    if( slots_.empty() )
+    {
+      // construction failed
+      EC_CHECK_ERROR( CL_INVALID_VALUE , errp , return nullptr )
+    }
+    slot_t& slot = slots_[ next_ ];
+    next_ = ( next_ + 1 ) % slots_.size();
+    if( slot.fence )
+    {
+      if( slot.fence.execution_status() != CL_COMPLETE )
+      {
+        ++stalls_;
+      }
+      int err;
+      slot.fence.wait( &err );
+      EC_CHECK_ERROR( err , errp , return nullptr )
+      slot.fence = detail::SharedEvent();
+    }
+    return &slot;
+  }
+
+public:
+  // slot_count must not be 0
+  StagingPool( CommandQueue queue ,
+      size_t slot_size=size_t(1)<<20 ,
+      size_t slot_count=4 ,
+      int* errp=nullptr )
+    : queue_( std::move( queue ) ) ,
+      slot_size_( slot_size )
+  {
+    if( slot_count == 0 )
+    {
+      EC_CHECK_ERROR( CL_INVALID_VALUE , errp , return )
+    }
+    const Context context = queue_.context( errp );
+    slots_.reserve( slot_count );
+    for( size_t i=0; i<slot_count; ++i )
+    {
+      Buffer buffer( context , CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR ,
+          slot_size , nullptr , errp );
+      if( !buffer )
+      {
+        return;
+      }
+      void* ptr = queue_.map_buffer( buffer , CL_TRUE , CL_MAP_READ | CL_MAP_WRITE ,
+          0 , slot_size , nullptr , errp );
+      if( ptr == nullptr )
+      {
+        return;
+      }
+      slots_.push_back( { std::move( buffer ) , ptr , {} } );
+    }
+  }
+  StagingPool( StagingPool const& ) = delete;
+  StagingPool& operator=( StagingPool const& ) = delete;
+  ~StagingPool()
+  {
+    for( auto& slot : slots_ )
+    {
+      const cl_event fence = slot.fence.get();
+      clEnqueueUnmapMemObject( queue_ , slot.buffer , slot.ptr ,
+          fence ? 1 : 0 , fence ? &fence : nullptr , nullptr );
+    }
+    queue_.finish();
+  }
+
+  size_t slot_size() const
+  {
+    return slot_size_;
+  }
+  size_t slot_count() const
+  {
+    return slots_.size();
+  }
+  // acquisitions that had to wait for a transfer still in flight
+  size_t stalls() const
+  {
+    return stalls_;
+  }
+};
+
+inline Event CommandQueue::upload( StagingPool& pool , cl_mem buffer ,
+    size_t offset , size_t size , void const* ptr ,
+    detail::list_view<cl_event> const& events , int* errp ) const
+{
+  std::vector< cl_event > chunks;
+  Event last;
+  for( size_t done=0; done<size; )
+  {
+    StagingPool::slot_t* slot = pool.acquire_( errp );
+    if( slot == nullptr )
+    {
+      return {};
+    }
+    const size_t n = std::min( pool.slot_size_ , size - done );
+    std::memcpy( slot->ptr , static_cast< char const* >( ptr ) + done , n );
+    last = write_buffer( buffer , CL_FALSE , offset + done , n , slot->ptr , events , errp );
+    if( !last )
+    {
+      return {};
+    }
+    slot->fence = last.share();
+    chunks.push_back( last.get() );
+    done += n;
+  }
+  if( chunks.size() > 1 )
+  {
+    // out-of-order queues may run the chunks in any order
+    return marker( chunks , errp );
+  }
+  EC_SET_ERRP( errp )
+  return last;
+}
+
+inline void CommandQueue::download( StagingPool& pool , cl_mem buffer ,
+    size_t offset , size_t size , void* ptr ,
+    detail::list_view<cl_event> const& events , int* errp ) const
+{
+  struct pending_t
+  {
+    StagingPool::slot_t* slot;
+    size_t done;
+    size_t size;
+  };
+  std::vector< pending_t > pending;
+  for( size_t done=0; done<size; )
+  {
+    // enqueue up to one chunk per slot , then copy out in order
+    pending.clear();
+    while( done < size && pending.size() < pool.slot_count() )
+    {
+      StagingPool::slot_t* slot = pool.acquire_( errp );
+      if( slot == nullptr )
+      {
+        return;
+      }
+      const size_t n = std::min( pool.slot_size_ , size - done );
+      Event ev = read_buffer( buffer , CL_FALSE , offset + done , n , slot->ptr , events , errp );
+      if( !ev )
+      {
+        return;
+      }
+      slot->fence = ev.share();
+      pending.push_back( { slot , done , n } );
+      done += n;
+    }
+    flush();
+    for( auto const& p : pending )
+    {
+      int err;
+      p.slot->fence.wait( &err );
+      EC_CHECK_ERROR( err , errp , return )
+      std::memcpy( static_cast< char* >( ptr ) + p.done , p.slot->ptr , p.size );
+    }
+  }
+  EC_SET_ERRP( errp )
+}
+
+}
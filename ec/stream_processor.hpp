@@ -0,0 +1,263 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "definitions.hpp"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace ec
+{
+
+// streams a host range larger than the device can hold through one kernel.
+// the range is cut into chunks; each chunk is written on the write queue ,
+// processed on the compute queue and read back on the read queue , the
+// stages chained by events. depth chunk slots rotate , so with depth 3 the
+// write of chunk k+1 , the kernel of chunk k and the read of chunk k-1 can
+// run at the same time. the queues may be the same object.
+//
+// kernel arguments 0 , 1 and 2 are set per chunk to the input buffer , the
+// output buffer and the element count of the chunk as cl_ulong; further
+// arguments are set by the caller beforehand.
+class StreamProcessor
+{
+public:
+  struct stats_t
+  {
+    size_t chunks = 0;
+    // device time in nanoseconds , from event profiling; all 0 unless
+    // every queue has CL_QUEUE_PROFILING_ENABLE
+    cl_ulong write = 0;
+    cl_ulong compute = 0;
+    cl_ulong read = 0;
+    // first command start to last command end
+    cl_ulong span = 0;
+    // share of the busy time hidden by running stages concurrently:
+    // 1 - span / ( write + compute + read ) , 0 when fully serialized
+    double overlap = 0;
+    // host seconds spent in run()
+    double wall = 0;
+  };
+
+protected:
+  struct slot_t
+  {
+    Buffer input;
+    Buffer output;
+    Event write;
+    Event compute;
+    Event read;
+  };
+
+  CommandQueue write_queue_;
+  CommandQueue compute_queue_;
+  CommandQueue read_queue_;
+  Kernel kernel_;
+  size_t input_size_;
+  size_t output_size_;
+  size_t chunk_ = 0;
+  size_t local_size_ = 0;
+  std::vector< slot_t > slots_;
+  stats_t stats_;
+  bool profiled_ = false;
+  cl_ulong first_ = 0;
+  cl_ulong last_ = 0;
+
+  // waits for the last chunk of slot and adds its commands to the stats
+  bool retire_( slot_t& slot , int* errp )
+  {
+    if( !slot.read )
+    {
+      return true;
+    }
+    int err;
+    slot.read.wait( &err );
+    EC_CHECK_ERROR( err , errp , return false )
+    Event const* stages[] = { &slot.write , &slot.compute , &slot.read };
+    cl_ulong* totals[] = { &stats_.write , &stats_.compute , &stats_.read };
+    for( size_t i=0; i<3 && profiled_; ++i )
+    {
+      const cl_ulong start = stages[i]->profiling_start( errp );
+      const cl_ulong end = stages[i]->profiling_end( errp );
+      *totals[i] += end - start;
+      first_ = std::min( first_ , start );
+      last_ = std::max( last_ , end );
+    }
+    slot.write = Event();
+    slot.compute = Event();
+    slot.read = Event();
+    return true;
+  }
+  // after a failure: commands already enqueued still read the input and
+  // write the output , so they must finish before run() returns
+  void drain_()
+  {
+    write_queue_.finish();
+    compute_queue_.finish();
+    read_queue_.finish();
+    for( auto& slot : slots_ )
+    {
+      slot.write = Event();
+      slot.compute = Event();
+      slot.read = Event();
+    }
+  }
+
+public:
+  // input_size and output_size are bytes per element. chunk is in elements;
+  // 0 picks 16 MiB of the larger element type , capped by
+  // CL_DEVICE_MAX_MEM_ALLOC_SIZE
+  StreamProcessor( CommandQueue write_queue , CommandQueue compute_queue ,
+      CommandQueue read_queue , Kernel kernel ,
+      size_t input_size , size_t output_size ,
+      size_t chunk=0 , size_t depth=3 ,
+      int* errp=nullptr )
+    : write_queue_( std::move( write_queue ) ) ,
+      compute_queue_( std::move( compute_queue ) ) ,
+      read_queue_( std::move( read_queue ) ) ,
+      kernel_( std::move( kernel ) ) ,
+      input_size_( input_size ) ,
+      output_size_( output_size ) ,
+      chunk_( chunk )
+  {
+    const size_t element = std::max< size_t >( std::max( input_size_ , output_size_ ) , 1 );
+    if( chunk_ == 0 )
+    {
+      const size_t max_alloc = compute_queue_.device( errp ).get_info< CL_DEVICE_MAX_MEM_ALLOC_SIZE >( errp );
+      chunk_ = std::max< size_t >( std::min( max_alloc , size_t(16) << 20 ) / element , 1 );
+    }
+    const Context context = compute_queue_.context( errp );
+    slots_.resize( std::max< size_t >( depth , 1 ) );
+    for( auto& slot : slots_ )
+    {
+      slot.input = Buffer( context , CL_MEM_READ_ONLY , chunk_ * std::max< size_t >( input_size_ , 1 ) ,
+          nullptr , errp );
+      slot.output = Buffer( context , CL_MEM_WRITE_ONLY , chunk_ * std::max< size_t >( output_size_ , 1 ) ,
+          nullptr , errp );
+      if( !slot.input || !slot.output )
+      {
+        return;
+      }
+    }
+  }
+  StreamProcessor( StreamProcessor const& ) = delete;
+  StreamProcessor& operator=( StreamProcessor const& ) = delete;
+
+  size_t chunk() const
+  {
+    return chunk_;
+  }
+  size_t depth() const
+  {
+    return slots_.size();
+  }
+  // 0 lets the runtime choose; otherwise the global size is rounded up and
+  // the kernel must check the count argument
+  void set_local_size( size_t local_size )
+  {
+    local_size_ = local_size;
+  }
+  // of the last run()
+  stats_t const& stats() const
+  {
+    return stats_;
+  }
+
+  // processes count elements from input into output; blocks until every
+  // chunk has been read back
+  stats_t const& run( void const* input , void* output , size_t count , int* errp=nullptr )
+  {
+    const auto begin = std::chrono::steady_clock::now();
+    stats_ = stats_t();
+    profiled_ = ( write_queue_.properties( errp ) & compute_queue_.properties( errp ) &
+        read_queue_.properties( errp ) & CL_QUEUE_PROFILING_ENABLE ) != 0;
+    first_ = std::numeric_limits< cl_ulong >::max();
+    last_ = 0;
+    // drains on every early return or exception
+    struct drainer_t
+    {
+      StreamProcessor* self;
+      ~drainer_t()
+      {
+        if( self != nullptr )
+        {
+          self->drain_();
+        }
+      }
+    } drainer{ this };
+
+    for( size_t done=0, k=0; done<count; done+=chunk_, ++k )
+    {
+      slot_t& slot = slots_[ k % slots_.size() ];
+      // chunk k-depth owned this slot; once it was read back , its
+      // input and output buffers are free
+      if( !retire_( slot , errp ) )
+      {
+        return stats_;
+      }
+      const size_t n = std::min( chunk_ , count - done );
+
+      slot.write = write_queue_.write_buffer( slot.input , CL_FALSE , 0 , n * input_size_ ,
+          static_cast< char const* >( input ) + done * input_size_ , nullptr , errp );
+      if( !slot.write )
+      {
+        return stats_;
+      }
+
+      kernel_[0] = slot.input.get();
+      kernel_[1] = slot.output.get();
+      kernel_[2] = static_cast< cl_ulong >( n );
+      const size_t global = local_size_ == 0 ? n :
+        ( n + local_size_ - 1 ) / local_size_ * local_size_;
+      // NDRange has no "runtime picks" local size of dimension 1
+      const cl_event written = slot.write.get();
+      cl_event computed;
+      const int err = clEnqueueNDRangeKernel( compute_queue_ , kernel_ , 1 , nullptr ,
+          &global , local_size_ == 0 ? nullptr : &local_size_ ,
+          1 , &written , &computed );
+      EC_CHECK_ERROR( err , errp , return stats_ )
+      slot.compute = detail::make_system_event( computed );
+
+      slot.read = read_queue_.read_buffer( slot.output , CL_FALSE , 0 , n * output_size_ ,
+          static_cast< char* >( output ) + done * output_size_ , slot.compute , errp );
+      if( !slot.read )
+      {
+        return stats_;
+      }
+      ++stats_.chunks;
+      // start all three stages now , not at the next wait
+      write_queue_.flush();
+      compute_queue_.flush();
+      read_queue_.flush();
+    }
+    for( size_t i=0; i<slots_.size(); ++i )
+    {
+      // oldest chunk first
+      if( !retire_( slots_[ ( stats_.chunks + i ) % slots_.size() ] , errp ) )
+      {
+        return stats_;
+      }
+    }
+    drainer.self = nullptr;
+
+    if( profiled_ && last_ > first_ )
+    {
+      stats_.span = last_ - first_;
+      const cl_ulong busy = stats_.write + stats_.compute + stats_.read;
+      stats_.overlap = busy > stats_.span ? 1.0 - double( stats_.span ) / double( busy ) : 0.0;
+    }
+    else
+    {
+      stats_.write = stats_.compute = stats_.read = 0;
+    }
+    const std::chrono::duration< double > wall = std::chrono::steady_clock::now() - begin;
+    stats_.wall = wall.count();
+    EC_SET_ERRP( errp )
+    return stats_;
+  }
+};
+
+}
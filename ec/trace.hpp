@@ -0,0 +1,627 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "definitions.hpp"
+#include "profiling.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ec
+{
+
+class TracedQueue;
+
+// records host-side spans around CommandQueue calls together with the
+// device START/END timestamps of the resulting events , and writes both
+// as one Chrome trace-event JSON file ( chrome://tracing , Perfetto ).
+//
+// device clocks are mapped onto the host clock per queue:
+// a command's QUEUED timestamp is taken while the host is inside the
+// enqueue call , so every command bounds the offset by
+// [ host_begin - queued , host_end - queued ]. the bounds of all
+// commands are intersected and the midpoint is used.
+//
+// queues must be created with CommandQueue::PROFILING for device spans.
+class Tracer
+{
+  friend class TracedQueue;
+
+public:
+  using clock = std::chrono::steady_clock;
+
+protected:
+  struct queue_t
+  {
+    CommandQueue queue;
+    int pid;
+    int tid;
+    // device ns + offset = host ns
+    long long offset_lo;
+    long long offset_hi;
+    bool calibrated;
+  };
+  struct host_span_t
+  {
+    std::string name;
+    queue_t const* queue;
+    int tid;
+    long long begin;
+    long long end;
+  };
+  struct device_span_t
+  {
+    std::string name;
+    queue_t const* queue;
+    cl_command_type type;
+    cl_ulong begin;
+    cl_ulong end;
+  };
+  struct pending_t
+  {
+    Tracer* self;
+    queue_t* queue;
+    std::string name;
+    long long host_begin;
+    long long host_end;
+  };
+
+  clock::time_point origin_;
+  mutable std::mutex mutex_;
+  std::vector< std::unique_ptr< queue_t > > queues_;
+  std::map< cl_device_id , std::pair< int , std::string > > devices_;
+  std::map< std::thread::id , int > threads_;
+  std::map< cl_kernel , std::pair< Kernel , std::string > > kernels_;
+  std::vector< host_span_t > host_spans_;
+  std::vector< device_span_t > device_spans_;
+  std::atomic< size_t > pending_;
+
+  long long now_() const
+  {
+    return std::chrono::duration_cast< std::chrono::nanoseconds >(
+        clock::now() - origin_ ).count();
+  }
+
+  static void callback_( cl_event event , cl_int status , void* userdata )
+  {
+    std::unique_ptr< pending_t > p( static_cast< pending_t* >( userdata ) );
+    Tracer* self = p->self;
+    cl_ulong queued , start , end;
+    cl_command_type type;
+    const bool ok = status == CL_COMPLETE &&
+      clGetEventProfilingInfo( event , CL_PROFILING_COMMAND_QUEUED ,
+          sizeof(queued) , &queued , nullptr ) == CL_SUCCESS &&
+      clGetEventProfilingInfo( event , CL_PROFILING_COMMAND_START ,
+          sizeof(start) , &start , nullptr ) == CL_SUCCESS &&
+      clGetEventProfilingInfo( event , CL_PROFILING_COMMAND_END ,
+          sizeof(end) , &end , nullptr ) == CL_SUCCESS &&
+      clGetEventInfo( event , CL_EVENT_COMMAND_TYPE ,
+          sizeof(type) , &type , nullptr ) == CL_SUCCESS;
+    if( ok )
+    {
+      std::lock_guard< std::mutex > lock( self->mutex_ );
+      queue_t& q = *p->queue;
+      const long long lo = p->host_begin - static_cast< long long >( queued );
+      const long long hi = p->host_end - static_cast< long long >( queued );
+      if( q.calibrated && lo <= q.offset_hi && hi >= q.offset_lo )
+      {
+        q.offset_lo = std::max( q.offset_lo , lo );
+        q.offset_hi = std::min( q.offset_hi , hi );
+      }
+      else
+      {
+        // first sample , or the clocks drifted apart: restart from this one
+        q.offset_lo = lo;
+        q.offset_hi = hi;
+        q.calibrated = true;
+      }
+      self->device_spans_.push_back( { std::move( p->name ) , p->queue , type , start , end } );
+    }
+    p.reset();
+    self->pending_.fetch_sub( 1 , std::memory_order_release );
+  }
+
+  // caller holds mutex_
+  int thread_id_()
+  {
+    auto it = threads_.find( std::this_thread::get_id() );
+    if( it == threads_.end() )
+    {
+      const int id = static_cast< int >( threads_.size() );
+      it = threads_.emplace( std::this_thread::get_id() , id ).first;
+    }
+    return it->second;
+  }
+  std::string kernel_name_( cl_kernel kernel )
+  {
+    std::lock_guard< std::mutex > lock( mutex_ );
+    auto it = kernels_.find( kernel );
+    if( it == kernels_.end() )
+    {
+      Kernel k( kernel );
+      std::string name = k.name().c_str();
+      it = kernels_.emplace( kernel ,
+          std::make_pair( std::move( k ) , std::move( name ) ) ).first;
+    }
+    return it->second.second;
+  }
+  void record_( queue_t* queue , std::string name , long long begin , cl_event event )
+  {
+    const long long end = now_();
+    if( event != NULL )
+    {
+      pending_t* p = new pending_t{ this , queue , name , begin , end };
+      pending_.fetch_add( 1 , std::memory_order_relaxed );
+      if( clSetEventCallback( event , CL_COMPLETE , callback_ , p ) != CL_SUCCESS )
+      {
+        delete p;
+        pending_.fetch_sub( 1 , std::memory_order_relaxed );
+      }
+    }
+    std::lock_guard< std::mutex > lock( mutex_ );
+    host_spans_.push_back( { std::move( name ) , queue , thread_id_() , begin , end } );
+  }
+
+  static void write_escaped_( std::ostream& os , std::string const& str )
+  {
+    for( char c : str )
+    {
+      switch( c )
+      {
+        case '"':  os << "\\\""; break;
+        case '\\': os << "\\\\"; break;
+        case '\n': os << "\\n"; break;
+        case '\t': os << "\\t"; break;
+        default:
+          if( static_cast< unsigned char >( c ) < 0x20 )
+          {
+            char buf[8];
+            std::snprintf( buf , sizeof(buf) , "\\u%04x" , c );
+            os << buf;
+          }
+          else
+          {
+            os << c;
+          }
+      }
+    }
+  }
+  static void write_time_( std::ostream& os , long long ns )
+  {
+    char buf[32];
+    std::snprintf( buf , sizeof(buf) , "%.3f" , ns / 1000.0 );
+    os << buf;
+  }
+
+public:
+  Tracer()
+    : origin_( clock::now() ) ,
+      pending_( 0 )
+  {
+  }
+  // drains every traced queue so no callback can outlive the tracer
+  ~Tracer()
+  {
+    for( auto const& q : queues_ )
+    {
+      q->queue.finish();
+    }
+    wait();
+  }
+  Tracer( Tracer const& ) = delete;
+  Tracer& operator=( Tracer const& ) = delete;
+
+  TracedQueue queue( CommandQueue queue , int* errp=nullptr );
+
+  // blocks until callbacks of every completed command have run.
+  // finish() the traced queues first.
+  void wait() const
+  {
+    while( pending_.load( std::memory_order_acquire ) != 0 )
+    {
+      std::this_thread::yield();
+    }
+  }
+
+  // pid 1 is the host , one pid per device , one tid per queue
+  void write( std::ostream& os ) const
+  {
+    wait();
+    std::lock_guard< std::mutex > lock( mutex_ );
+    os << "{\"traceEvents\":[\n";
+    os << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"host\"}}";
+    for( auto const& t : threads_ )
+    {
+      os << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t.second
+        << ",\"args\":{\"name\":\"thread " << t.second << "\"}}";
+    }
+    for( auto const& d : devices_ )
+    {
+      os << ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << d.second.first
+        << ",\"args\":{\"name\":\"";
+      write_escaped_( os , d.second.second );
+      os << "\"}}";
+    }
+    for( auto const& q : queues_ )
+    {
+      os << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << q->pid
+        << ",\"tid\":" << q->tid
+        << ",\"args\":{\"name\":\"queue " << q->tid << "\"}}";
+    }
+    for( auto const& s : host_spans_ )
+    {
+      os << ",\n{\"name\":\"";
+      write_escaped_( os , s.name );
+      os << "\",\"cat\":\"host\",\"ph\":\"X\",\"pid\":1,\"tid\":" << s.tid << ",\"ts\":";
+      write_time_( os , s.begin );
+      os << ",\"dur\":";
+      write_time_( os , s.end - s.begin );
+      os << ",\"args\":{\"queue\":" << s.queue->tid << "}}";
+    }
+    for( auto const& s : device_spans_ )
+    {
+      queue_t const& q = *s.queue;
+      const long long offset = q.offset_lo + ( q.offset_hi - q.offset_lo )/2;
+      os << ",\n{\"name\":\"";
+      write_escaped_( os , s.name );
+      os << "\",\"cat\":\"device\",\"ph\":\"X\",\"pid\":" << q.pid
+        << ",\"tid\":" << q.tid << ",\"ts\":";
+      write_time_( os , static_cast< long long >( s.begin ) + offset );
+      os << ",\"dur\":";
+      write_time_( os , static_cast< long long >( s.end - s.begin ) );
+      os << ",\"args\":{\"command\":\"" << detail::command_type_string( s.type ) << "\"}}";
+    }
+    os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+  }
+  bool write( const char* path ) const
+  {
+    std::ofstream os( path );
+    if( !os )
+    {
+      return false;
+    }
+    write( os );
+    return static_cast< bool >( os );
+  }
+};
+
+// CommandQueue front-end that reports every call to a Tracer.
+// ndrange() and task() spans are named after Kernel::name().
+// ec::no_event overloads are not offered: device spans need the event.
+class TracedQueue
+{
+  friend class Tracer;
+
+  Tracer* tracer_;
+  Tracer::queue_t* queue_;
+
+  TracedQueue( Tracer* tracer , Tracer::queue_t* queue )
+    : tracer_( tracer ) ,
+      queue_( queue )
+  {
+  }
+  Event end_( const char* name , long long begin , Event ev ) const
+  {
+    tracer_->record_( queue_ , name , begin , ev.get() );
+    return ev;
+  }
+  Event end_( cl_kernel kernel , long long begin , Event ev ) const
+  {
+    tracer_->record_( queue_ , tracer_->kernel_name_( kernel ) , begin , ev.get() );
+    return ev;
+  }
+  long long begin_() const
+  {
+    return tracer_->now_();
+  }
+
+public:
+  TracedQueue()
+    : tracer_( nullptr ) ,
+      queue_( nullptr )
+  {
+  }
+
+  CommandQueue const& queue() const
+  {
+    return queue_->queue;
+  }
+  operator cl_command_queue() const
+  {
+    return queue_->queue.get();
+  }
+  operator bool() const
+  {
+    return queue_ != nullptr;
+  }
+
+  Event marker( detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "marker" , b , queue().marker( events , errp ) );
+  }
+  Event barrier( detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "barrier" , b , queue().barrier( events , errp ) );
+  }
+  Event read_buffer( cl_mem buffer , cl_bool block ,
+      size_t offset , size_t size , void* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "read_buffer" , b ,
+        queue().read_buffer( buffer , block , offset , size , ptr , events , errp ) );
+  }
+  Event write_buffer( cl_mem buffer , cl_bool block ,
+      size_t offset , size_t size , void const* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "write_buffer" , b ,
+        queue().write_buffer( buffer , block , offset , size , ptr , events , errp ) );
+  }
+  Event copy_buffer( cl_mem src , cl_mem dst ,
+      size_t src_offset , size_t dst_offset ,
+      size_t size ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "copy_buffer" , b ,
+        queue().copy_buffer( src , dst , src_offset , dst_offset , size , events , errp ) );
+  }
+  Event fill_buffer( cl_mem buffer ,
+      void const* pattern , size_t pattern_size ,
+      size_t offset , size_t bytes ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "fill_buffer" , b ,
+        queue().fill_buffer( buffer , pattern , pattern_size , offset , bytes , events , errp ) );
+  }
+  template < typename T >
+  Event fill_buffer( cl_mem buffer ,
+      T const& pattern ,
+      size_t offsetbytes , size_t count ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    return fill_buffer( buffer , &pattern , sizeof(T) ,
+        offsetbytes , sizeof(T)*count , events , errp );
+  }
+  template < typename T = void >
+  T*
+  map_buffer( cl_mem buffer ,
+      cl_bool block , cl_map_flags flags ,
+      size_t offset , size_t size ,
+      detail::list_view<cl_event> const& events ,
+      Event& event ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    Event ev;
+    T* ret = queue().map_buffer< T >( buffer , block , flags , offset , size ,
+        events , ev , errp );
+    event = end_( "map_buffer" , b , std::move( ev ) );
+    return ret;
+  }
+  template < typename T = void >
+  T*
+  map_buffer( cl_mem buffer ,
+      cl_bool block , cl_map_flags flags ,
+      size_t offset , size_t size ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    Event event;
+    return map_buffer< T >( buffer , block , flags , offset , size ,
+        events , event , errp );
+  }
+  Event unmap( cl_mem mem , void* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "unmap" , b , queue().unmap( mem , ptr , events , errp ) );
+  }
+  Event read_buffer_rect( cl_mem buffer , cl_bool block ,
+      ImageOffset const& buffer_offset , ImageOffset const& host_offset ,
+      ImageSize const& size ,
+      ImagePitch const& buffer_pitch , ImagePitch const& host_pitch ,
+      void* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "read_buffer_rect" , b ,
+        queue().read_buffer_rect( buffer , block , buffer_offset , host_offset , size ,
+          buffer_pitch , host_pitch , ptr , events , errp ) );
+  }
+  Event write_buffer_rect( cl_mem buffer , cl_bool block ,
+      ImageOffset const& buffer_offset , ImageOffset const& host_offset ,
+      ImageSize const& size ,
+      ImagePitch const& buffer_pitch , ImagePitch const& host_pitch ,
+      void const* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "write_buffer_rect" , b ,
+        queue().write_buffer_rect( buffer , block , buffer_offset , host_offset , size ,
+          buffer_pitch , host_pitch , ptr , events , errp ) );
+  }
+  Event copy_buffer_rect( cl_mem src , cl_mem dst ,
+      ImageOffset const& src_offset , ImageOffset const& dst_offset ,
+      ImageSize const& size ,
+      ImagePitch const& src_pitch , ImagePitch const& dst_pitch ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "copy_buffer_rect" , b ,
+        queue().copy_buffer_rect( src , dst , src_offset , dst_offset , size ,
+          src_pitch , dst_pitch , events , errp ) );
+  }
+  Event read_image( cl_mem image , cl_bool block ,
+      ImageOffset const& offset , ImageSize const& size ,
+      ImagePitch const& pitch ,
+      void* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "read_image" , b ,
+        queue().read_image( image , block , offset , size , pitch , ptr , events , errp ) );
+  }
+  Event write_image( cl_mem image , cl_bool block ,
+      ImageOffset const& offset , ImageSize const& size ,
+      ImagePitch const& pitch ,
+      void const* ptr ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "write_image" , b ,
+        queue().write_image( image , block , offset , size , pitch , ptr , events , errp ) );
+  }
+  Event copy_image( cl_mem src , cl_mem dst ,
+      ImageOffset const& src_offset , ImageOffset const& dst_offset ,
+      ImageSize const& size ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "copy_image" , b ,
+        queue().copy_image( src , dst , src_offset , dst_offset , size , events , errp ) );
+  }
+  Event fill_image( cl_mem image ,
+      void const* color ,
+      ImageOffset const& offset , ImageSize const& size ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "fill_image" , b ,
+        queue().fill_image( image , color , offset , size , events , errp ) );
+  }
+  Event copy_image_to_buffer( cl_mem image , cl_mem buffer ,
+      ImageOffset const& image_offset , ImageSize const& image_size ,
+      size_t buffer_offset ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "copy_image_to_buffer" , b ,
+        queue().copy_image_to_buffer( image , buffer , image_offset , image_size ,
+          buffer_offset , events , errp ) );
+  }
+  Event copy_buffer_to_image( cl_mem buffer , cl_mem image ,
+      size_t buffer_offset ,
+      ImageOffset const& image_offset , ImageSize const& image_size ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( "copy_buffer_to_image" , b ,
+        queue().copy_buffer_to_image( buffer , image , buffer_offset ,
+          image_offset , image_size , events , errp ) );
+  }
+  template < typename T = void >
+  T*
+  map_image( cl_mem image ,
+      cl_bool block , cl_map_flags flags ,
+      ImageOffset const& offset , ImageSize const& size ,
+      ImagePitch& host_pitch ,
+      detail::list_view<cl_event> const& events ,
+      Event& event ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    Event ev;
+    T* ret = queue().map_image< T >( image , block , flags , offset , size ,
+        host_pitch , events , ev , errp );
+    event = end_( "map_image" , b , std::move( ev ) );
+    return ret;
+  }
+  template < typename T = void >
+  T*
+  map_image( cl_mem image ,
+      cl_bool block , cl_map_flags flags ,
+      ImageOffset const& offset , ImageSize const& size ,
+      ImagePitch& host_pitch ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    Event event;
+    return map_image< T >( image , block , flags , offset , size , host_pitch ,
+        events , event , errp );
+  }
+  Event ndrange( cl_kernel kernel ,
+      NDRange const& global_offsets ,
+      NDRange const& global_size ,
+      NDRange const& local_size ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( kernel , b ,
+        queue().ndrange( kernel , global_offsets , global_size , local_size , events , errp ) );
+  }
+  Event task( cl_kernel kernel ,
+      detail::list_view<cl_event> const& events ,
+      int* errp=nullptr ) const
+  {
+    const long long b = begin_();
+    return end_( kernel , b , queue().task( kernel , events , errp ) );
+  }
+
+  void finish() const
+  {
+    const long long b = begin_();
+    queue().finish();
+    tracer_->record_( queue_ , "finish" , b , NULL );
+  }
+  void flush() const
+  {
+    const long long b = begin_();
+    queue().flush();
+    tracer_->record_( queue_ , "flush" , b , NULL );
+  }
+};
+
+inline TracedQueue Tracer::queue( CommandQueue queue , int* errp )
+{
+  const Device device = queue.device( errp );
+  std::string name;
+  if( device )
+  {
+    name = device.get_info< CL_DEVICE_NAME >( errp ).c_str();
+  }
+  std::lock_guard< std::mutex > lock( mutex_ );
+  auto it = devices_.find( device.get() );
+  if( it == devices_.end() )
+  {
+    const int pid = static_cast< int >( devices_.size() ) + 2;
+    it = devices_.emplace( device.get() , std::make_pair( pid , std::move( name ) ) ).first;
+  }
+  const int tid = static_cast< int >( queues_.size() );
+  queues_.emplace_back( new queue_t{ std::move( queue ) , it->second.first , tid , 0 , 0 , false } );
+  return { this , queues_.back().get() };
+}
+
+}
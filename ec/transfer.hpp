@@ -0,0 +1,485 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "definitions.hpp"
+#include "host_memory.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ec
+{
+
+// fastest way to move data between host and one device , per size class.
+// COPY is read_buffer / write_buffer , MAP copies through a mapping of the
+// destination , HOST_PTR wraps the host memory in a CL_MEM_USE_HOST_PTR
+// buffer and lets the device copy it.
+// profiles are measured once per device by get() and cached for the
+// process; CommandQueue::transfer_to_device() / transfer_to_host() use them
+class TransferProfile
+{
+public:
+  enum method_t { COPY , MAP , HOST_PTR };
+  // 4 KiB , 32 KiB , 256 KiB , 2 MiB , 16 MiB
+  constexpr static size_t class_count = 5;
+
+protected:
+  bool unified_ = false;
+  bool calibrated_ = false;
+  method_t to_device_[ class_count ];
+  method_t to_host_[ class_count ];
+
+  // one per device , calibrated by the first transfer to reach it
+  struct entry_t;
+  using table_t = std::map< cl_device_id , entry_t* >;
+  struct registry_t;
+  static registry_t& registry_();
+  static entry_t* publish_( registry_t& reg , cl_device_id device , entry_t* entry );
+  static entry_t* entry_( cl_device_id device );
+  // seconds of the fastest of reps runs of f , after one warm-up run.
+  // infinite once any run , the warm-up included , returns an error
+  template < typename F >
+  static double time_( F&& f , int reps )
+  {
+    const double failed = std::numeric_limits< double >::infinity();
+    if( f() != CL_SUCCESS )
+    {
+      return failed;
+    }
+    double ret = failed;
+    for( int i=0; i<reps; ++i )
+    {
+      const auto begin = std::chrono::steady_clock::now();
+      if( f() != CL_SUCCESS )
+      {
+        return failed;
+      }
+      const std::chrono::duration< double > took = std::chrono::steady_clock::now() - begin;
+      ret = std::min( ret , took.count() );
+    }
+    return ret;
+  }
+  // error codes instead of errp , for callers that fall back to COPY.
+  // calibrate_ leaves the unmeasured guess in ret for failing setups
+  static int calibrate_( cl_command_queue queue , int reps , TransferProfile& ret );
+  // the cached profile , calibrated on first use , or nullptr if the queue's
+  // device is unknown. calibration runs outside any lock; concurrent calls
+  // for the same device wait for it , others do not. a failed calibration
+  // is cached as well and reported only to the call that ran it
+  static int find_( cl_command_queue queue , TransferProfile const*& ret );
+  friend class CommandQueue;
+
+public:
+  TransferProfile()
+    : TransferProfile( false )
+  {
+  }
+  // unmeasured guess: MAP on host-unified devices , COPY elsewhere
+  explicit TransferProfile( bool unified )
+    : unified_( unified )
+  {
+    std::fill_n( to_device_ , class_count , unified ? MAP : COPY );
+    std::fill_n( to_host_ , class_count , unified ? MAP : COPY );
+  }
+
+  static size_t class_size( size_t c )
+  {
+    return size_t(4) << ( 10 + 3*c );
+  }
+  // smallest class holding size , the last one for anything larger
+  static size_t size_class( size_t size )
+  {
+    size_t c = 0;
+    while( c + 1 < class_count && size > class_size( c ) )
+    {
+      ++c;
+    }
+    return c;
+  }
+
+  bool unified() const
+  {
+    return unified_;
+  }
+  bool calibrated() const
+  {
+    return calibrated_;
+  }
+  method_t to_device( size_t size ) const
+  {
+    return to_device_[ size_class( size ) ];
+  }
+  method_t to_host( size_t size ) const
+  {
+    return to_host_[ size_class( size ) ];
+  }
+  void set( size_t c , method_t to_device , method_t to_host )
+  {
+    to_device_[c] = to_device;
+    to_host_[c] = to_host;
+  }
+
+  // times every method and direction on queue , up to the size class
+  // CL_DEVICE_MAX_MEM_ALLOC_SIZE allows; methods the device rejects are
+  // skipped. blocking
+  static TransferProfile calibrate( CommandQueue const& queue , int reps=3 ,
+      int* errp=nullptr );
+  // cached profile of the queue's device , calibrated on first use.
+  // transfer_to_device() / transfer_to_host() fall back to COPY when it fails
+  static TransferProfile get( CommandQueue const& queue , int* errp=nullptr );
+  // replaces the cached profile , e.g. with one kept from an earlier run
+  static void store( cl_device_id device , TransferProfile const& profile );
+};
+
+struct TransferProfile::entry_t
+{
+  std::once_flag once;
+  TransferProfile profile;
+};
+
+// transfers look entries up in an immutable table with one atomic load.
+// inserts publish a copy under the mutex; entries and old tables are kept
+// until exit , so a reader never sees one freed
+struct TransferProfile::registry_t
+{
+  std::mutex mutex;
+  std::atomic< table_t const* > table{ nullptr };
+  std::vector< std::unique_ptr< entry_t > > entries;
+  std::vector< std::unique_ptr< table_t const > > tables;
+};
+
+inline TransferProfile::registry_t& TransferProfile::registry_()
+{
+  static registry_t ret;
+  return ret;
+}
+
+// under the mutex: maps device to entry , or to a new one if null
+inline TransferProfile::entry_t* TransferProfile::publish_( registry_t& reg ,
+    cl_device_id device , entry_t* entry )
+{
+  if( entry == nullptr )
+  {
+    reg.entries.emplace_back( new entry_t );
+    entry = reg.entries.back().get();
+  }
+  table_t const* table = reg.table.load( std::memory_order_relaxed );
+  std::unique_ptr< table_t > next( table ? new table_t( *table ) : new table_t() );
+  ( *next )[ device ] = entry;
+  reg.table.store( next.get() , std::memory_order_release );
+  reg.tables.emplace_back( std::move( next ) );
+  return entry;
+}
+
+inline TransferProfile::entry_t* TransferProfile::entry_( cl_device_id device )
+{
+  registry_t& reg = registry_();
+  table_t const* table = reg.table.load( std::memory_order_acquire );
+  if( table != nullptr )
+  {
+    auto it = table->find( device );
+    if( it != table->end() )
+    {
+      return it->second;
+    }
+  }
+  std::lock_guard< std::mutex > lock( reg.mutex );
+  // another thread may have inserted it meanwhile
+  table = reg.table.load( std::memory_order_relaxed );
+  if( table != nullptr )
+  {
+    auto it = table->find( device );
+    if( it != table->end() )
+    {
+      return it->second;
+    }
+  }
+  return publish_( reg , device , nullptr );
+}
+
+inline void TransferProfile::store( cl_device_id device , TransferProfile const& profile )
+{
+  // a new entry , the old one may still be read
+  std::unique_ptr< entry_t > entry( new entry_t );
+  entry->profile = profile;
+  std::call_once( entry->once , []{} );
+  registry_t& reg = registry_();
+  std::lock_guard< std::mutex > lock( reg.mutex );
+  reg.entries.push_back( std::move( entry ) );
+  publish_( reg , device , reg.entries.back().get() );
+}
+
+namespace detail
+{
+
+// raw calls returning the error , so calibration can skip a method the
+// device rejects instead of throwing
+inline int transfer_to_device_( cl_command_queue queue , TransferProfile::method_t method ,
+    cl_mem buffer , size_t offset , size_t size , void const* ptr ,
+    detail::list_view<cl_event> const& events , cl_event* ev )
+{
+  int err;
+  switch( method )
+  {
+  case TransferProfile::MAP:
+  {
+    void* mapped = clEnqueueMapBuffer( queue , buffer , CL_TRUE , CL_MAP_WRITE_INVALIDATE_REGION ,
+        offset , size , events.size() , events.data() , nullptr , &err );
+    if( err != CL_SUCCESS )
+    {
+      return err;
+    }
+    std::memcpy( mapped , ptr , size );
+    return clEnqueueUnmapMemObject( queue , buffer , mapped , 0 , nullptr , ev );
+  }
+  case TransferProfile::HOST_PTR:
+  {
+    cl_context context;
+    err = clGetCommandQueueInfo( queue , CL_QUEUE_CONTEXT , sizeof(context) , &context , nullptr );
+    if( err != CL_SUCCESS )
+    {
+      return err;
+    }
+    const cl_mem host = clCreateBuffer( context , CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR ,
+        size , const_cast< void* >( ptr ) , &err );
+    if( err != CL_SUCCESS )
+    {
+      return err;
+    }
+    err = clEnqueueCopyBuffer( queue , host , buffer , 0 , offset , size ,
+        events.size() , events.data() , ev );
+    // the runtime keeps the wrapper alive until the copy completed
+    clReleaseMemObject( host );
+    return err;
+  }
+  default:
+    return clEnqueueWriteBuffer( queue , buffer , CL_FALSE , offset , size , ptr ,
+        events.size() , events.data() , ev );
+  }
+}
+inline int transfer_to_host_( cl_command_queue queue , TransferProfile::method_t method ,
+    cl_mem buffer , size_t offset , size_t size , void* ptr ,
+    detail::list_view<cl_event> const& events )
+{
+  int err;
+  switch( method )
+  {
+  case TransferProfile::MAP:
+  {
+    void* mapped = clEnqueueMapBuffer( queue , buffer , CL_TRUE , CL_MAP_READ ,
+        offset , size , events.size() , events.data() , nullptr , &err );
+    if( err != CL_SUCCESS )
+    {
+      return err;
+    }
+    std::memcpy( ptr , mapped , size );
+    return clEnqueueUnmapMemObject( queue , buffer , mapped , 0 , nullptr , nullptr );
+  }
+  case TransferProfile::HOST_PTR:
+  {
+    cl_context context;
+    err = clGetCommandQueueInfo( queue , CL_QUEUE_CONTEXT , sizeof(context) , &context , nullptr );
+    if( err != CL_SUCCESS )
+    {
+      return err;
+    }
+    const cl_mem host = clCreateBuffer( context , CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR ,
+        size , ptr , &err );
+    if( err != CL_SUCCESS )
+    {
+      return err;
+    }
+    cl_event copied;
+    err = clEnqueueCopyBuffer( queue , buffer , host , offset , 0 , size ,
+        events.size() , events.data() , &copied );
+    if( err == CL_SUCCESS )
+    {
+      // ptr only holds the result once mapped
+      void* mapped = clEnqueueMapBuffer( queue , host , CL_TRUE , CL_MAP_READ , 0 , size ,
+          1 , &copied , nullptr , &err );
+      clReleaseEvent( copied );
+      if( err == CL_SUCCESS )
+      {
+        if( mapped != ptr )
+        {
+          std::memcpy( ptr , mapped , size );
+        }
+        err = clEnqueueUnmapMemObject( queue , host , mapped , 0 , nullptr , nullptr );
+      }
+    }
+    clReleaseMemObject( host );
+    return err;
+  }
+  default:
+    return clEnqueueReadBuffer( queue , buffer , CL_TRUE , offset , size , ptr ,
+        events.size() , events.data() , nullptr );
+  }
+}
+
+}
+
+inline int TransferProfile::calibrate_( cl_command_queue queue , int reps ,
+    TransferProfile& ret )
+{
+  cl_device_id device;
+  int err = clGetCommandQueueInfo( queue , CL_QUEUE_DEVICE , sizeof(device) , &device , nullptr );
+  if( err != CL_SUCCESS )
+  {
+    return err;
+  }
+  cl_bool unified = CL_FALSE;
+  cl_ulong max_alloc = 0;
+  cl_context context;
+  if( ( err = clGetDeviceInfo( device , CL_DEVICE_HOST_UNIFIED_MEMORY ,
+          sizeof(unified) , &unified , nullptr ) ) != CL_SUCCESS ||
+      ( err = clGetDeviceInfo( device , CL_DEVICE_MAX_MEM_ALLOC_SIZE ,
+          sizeof(max_alloc) , &max_alloc , nullptr ) ) != CL_SUCCESS ||
+      ( err = clGetCommandQueueInfo( queue , CL_QUEUE_CONTEXT ,
+          sizeof(context) , &context , nullptr ) ) != CL_SUCCESS )
+  {
+    return err;
+  }
+  ret = TransferProfile( unified != CL_FALSE );
+  size_t classes = 0;
+  while( classes < class_count && class_size( classes ) <= max_alloc )
+  {
+    ++classes;
+  }
+  if( classes == 0 )
+  {
+    return CL_SUCCESS;
+  }
+  const size_t largest = class_size( classes - 1 );
+  const cl_mem scratch = clCreateBuffer( context , CL_MEM_READ_WRITE , largest , nullptr , &err );
+  if( err != CL_SUCCESS )
+  {
+    return err;
+  }
+  // page-aligned , so HOST_PTR is measured without a driver-side copy
+  aligned_vector< char > host( largest );
+
+  const method_t methods[] = { COPY , MAP , HOST_PTR };
+  for( size_t c=0; c<classes; ++c )
+  {
+    const size_t size = class_size( c );
+    double best_to = std::numeric_limits< double >::infinity();
+    double best_from = best_to;
+    // a method failing in any run is skipped , the guess stays when all fail
+    for( method_t method : methods )
+    {
+      const double to = time_( [&]
+          {
+            cl_event ev;
+            int e = detail::transfer_to_device_( queue , method , scratch , 0 , size ,
+                host.data() , nullptr , &ev );
+            if( e == CL_SUCCESS )
+            {
+              e = clWaitForEvents( 1 , &ev );
+              clReleaseEvent( ev );
+            }
+            return e;
+          } , reps );
+      if( to < best_to )
+      {
+        best_to = to;
+        ret.to_device_[c] = method;
+      }
+      const double from = time_( [&]
+          {
+            return detail::transfer_to_host_( queue , method , scratch , 0 , size ,
+                host.data() , nullptr );
+          } , reps );
+      if( from < best_from )
+      {
+        best_from = from;
+        ret.to_host_[c] = method;
+      }
+    }
+  }
+  // sizes the device cannot allocate behave like the largest measured
+  for( size_t c=classes; c<class_count; ++c )
+  {
+    ret.to_device_[c] = ret.to_device_[ classes - 1 ];
+    ret.to_host_[c] = ret.to_host_[ classes - 1 ];
+  }
+  ret.calibrated_ = true;
+  clFinish( queue );
+  clReleaseMemObject( scratch );
+  return CL_SUCCESS;
+}
+
+inline int TransferProfile::find_( cl_command_queue queue , TransferProfile const*& ret )
+{
+  ret = nullptr;
+  cl_device_id device;
+  int err = clGetCommandQueueInfo( queue , CL_QUEUE_DEVICE , sizeof(device) , &device , nullptr );
+  if( err != CL_SUCCESS )
+  {
+    return err;
+  }
+  entry_t* entry = entry_( device );
+  // cached even when calibration failed , so it is not retried per transfer
+  std::call_once( entry->once , [&]
+      {
+        err = calibrate_( queue , 3 , entry->profile );
+      } );
+  ret = &entry->profile;
+  return err;
+}
+
+inline TransferProfile TransferProfile::calibrate( CommandQueue const& queue , int reps ,
+    int* errp )
+{
+  TransferProfile ret;
+  const int err = calibrate_( queue , reps , ret );
+  EC_CHECK_ERROR( err , errp , return ret )
+  EC_SET_ERRP( errp )
+  return ret;
+}
+
+inline TransferProfile TransferProfile::get( CommandQueue const& queue , int* errp )
+{
+  TransferProfile const* ret;
+  const int err = find_( queue , ret );
+  EC_CHECK_ERROR( err , errp , return ret ? *ret : TransferProfile() )
+  EC_SET_ERRP( errp )
+  return *ret;
+}
+
+inline Event CommandQueue::transfer_to_device( cl_mem buffer ,
+    size_t offset , size_t size , void const* ptr ,
+    detail::list_view<cl_event> const& events , int* errp ) const
+{
+  TransferProfile const* profile;
+  // without a profile the plain write still works
+  const TransferProfile::method_t method = TransferProfile::find_( get() , profile ) == CL_SUCCESS ?
+    profile->to_device( size ) : TransferProfile::COPY;
+  cl_event ev;
+  const int err = detail::transfer_to_device_( get() , method , buffer , offset , size , ptr ,
+      events , &ev );
+  EC_CHECK_ERROR( err , errp , return detail::make_system_event() )
+  EC_SET_ERRP( errp )
+  return detail::make_system_event( ev );
+}
+
+inline void CommandQueue::transfer_to_host( cl_mem buffer ,
+    size_t offset , size_t size , void* ptr ,
+    detail::list_view<cl_event> const& events , int* errp ) const
+{
+  TransferProfile const* profile;
+  const TransferProfile::method_t method = TransferProfile::find_( get() , profile ) == CL_SUCCESS ?
+    profile->to_host( size ) : TransferProfile::COPY;
+  const int err = detail::transfer_to_host_( get() , method , buffer , offset , size , ptr ,
+      events );
+  EC_CHECK_ERROR( err , errp , return )
+  EC_SET_ERRP( errp )
+}
+
+}
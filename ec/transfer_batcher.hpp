@@ -0,0 +1,304 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "definitions.hpp"
+#include "ndrange.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace ec
+{
+
+namespace detail
+{
+// descriptors are ( staging offset , buffer offset , size ) in bytes.
+// one work-group per piece; word copies when everything is 4-byte aligned
+constexpr const char* transfer_batcher_source = R"CLC(
+__kernel void ec_scatter( __global const uchar* staging , ulong desc_offset ,
+    __global uchar* dst )
+{
+  __global const ulong* desc =
+    (__global const ulong*)( staging + desc_offset ) + 3*get_group_id(0);
+  const ulong s = desc[0];
+  const ulong d = desc[1];
+  const ulong n = desc[2];
+  if( ( ( s | d | n ) & 3 ) == 0 )
+  {
+    __global const uint* from = (__global const uint*)( staging + s );
+    __global uint* to = (__global uint*)( dst + d );
+    for( ulong i=get_local_id(0); i<n/4; i+=get_local_size(0) ) to[i] = from[i];
+  }
+  else
+  {
+    for( ulong i=get_local_id(0); i<n; i+=get_local_size(0) ) dst[d+i] = staging[s+i];
+  }
+}
+__kernel void ec_gather( __global uchar* staging , ulong desc_offset ,
+    __global const uchar* src )
+{
+  __global const ulong* desc =
+    (__global const ulong*)( staging + desc_offset ) + 3*get_group_id(0);
+  const ulong s = desc[0];
+  const ulong d = desc[1];
+  const ulong n = desc[2];
+  if( ( ( s | d | n ) & 3 ) == 0 )
+  {
+    __global const uint* from = (__global const uint*)( src + d );
+    __global uint* to = (__global uint*)( staging + s );
+    for( ulong i=get_local_id(0); i<n/4; i+=get_local_size(0) ) to[i] = from[i];
+  }
+  else
+  {
+    for( ulong i=get_local_id(0); i<n; i+=get_local_size(0) ) staging[s+i] = src[d+i];
+  }
+}
+)CLC";
+}
+
+// coalesces many small buffer writes and reads into one transfer each way.
+// write() packs the bytes on the host; flush() uploads data and descriptors
+// with a single write_buffer , then one ec_scatter launch per destination
+// buffer places the pieces. read() works in reverse: ec_gather packs the
+// pieces on the device and a single read_buffer brings them back.
+// pieces of one flush must not overlap each other.
+class TransferBatcher
+{
+protected:
+  struct piece_t
+  {
+    cl_mem buffer;
+    size_t offset;
+    size_t size;
+    // write: offset in the host pack , read: destination
+    size_t packed;
+    void* ptr;
+  };
+  struct pack_t
+  {
+    std::vector< char > bytes;
+    detail::SharedEvent fence;
+  };
+
+  CommandQueue queue_;
+  Context context_;
+  Kernel scatter_;
+  Kernel gather_;
+  size_t local_size_ = 64;
+
+  pack_t packs_[2];
+  size_t current_ = 0;
+  std::vector< piece_t > writes_;
+  std::vector< piece_t > reads_;
+  size_t read_bytes_ = 0;
+  Buffer staging_;
+  size_t staging_size_ = 0;
+  // scatters of the previous flush , which still read staging_
+  detail::SharedEvent last_;
+  std::vector< char > readback_;
+
+  constexpr static size_t align_ = 8;
+  static size_t aligned_( size_t x )
+  {
+    return ( x + align_ - 1 ) / align_ * align_;
+  }
+  pack_t& pack_( int* errp )
+  {
+    pack_t& pack = packs_[ current_ ];
+    if( pack.fence )
+    {
+      // the previous upload from this pack may still read it
+      int err;
+      pack.fence.wait( &err );
+      EC_CHECK_ERROR( err , errp , return pack )
+      pack.fence = detail::SharedEvent();
+    }
+    return pack;
+  }
+  // descriptors sorted by buffer; returns the launches as ( buffer , first , count )
+  static void describe_( std::vector< piece_t >& pieces , std::vector< cl_ulong >& desc ,
+      std::vector< std::pair< cl_mem , std::pair< size_t , size_t > > >& launches )
+  {
+    std::stable_sort( pieces.begin() , pieces.end() ,
+        []( piece_t const& a , piece_t const& b ){ return a.buffer < b.buffer; } );
+    for( size_t i=0; i<pieces.size(); ++i )
+    {
+      if( i == 0 || pieces[i].buffer != pieces[i-1].buffer )
+      {
+        launches.push_back( { pieces[i].buffer , { desc.size()/3 , 0 } } );
+      }
+      ++launches.back().second.second;
+      desc.push_back( pieces[i].packed );
+      desc.push_back( pieces[i].offset );
+      desc.push_back( pieces[i].size );
+    }
+  }
+  Event launch_( Kernel const& kernel , cl_mem buffer , size_t desc_offset , size_t count ,
+      detail::list_view<cl_event> const& events , int* errp )
+  {
+    kernel[0] = staging_.get();
+    kernel[1] = static_cast< cl_ulong >( desc_offset );
+    kernel[2] = buffer;
+    return queue_.ndrange( kernel , NDRange( 0 ) , NDRange( count*local_size_ ) ,
+        NDRange( local_size_ ) , events , errp );
+  }
+
+public:
+  TransferBatcher( CommandQueue queue , int* errp=nullptr )
+    : queue_( std::move( queue ) )
+  {
+    context_ = queue_.context( errp );
+    const Device device = queue_.device( errp );
+    Program program( context_ , detail::transfer_batcher_source ,
+        std::strlen( detail::transfer_batcher_source ) , errp );
+    if( !program )
+    {
+      return;
+    }
+    program.build( device.get() , nullptr , nullptr , nullptr , errp );
+    scatter_ = program.kernel( "ec_scatter" , errp );
+    gather_ = program.kernel( "ec_gather" , errp );
+    local_size_ = std::min< size_t >( local_size_ ,
+        device.get_info< CL_DEVICE_MAX_WORK_GROUP_SIZE >( errp ) );
+  }
+  TransferBatcher( TransferBatcher const& ) = delete;
+  TransferBatcher& operator=( TransferBatcher const& ) = delete;
+
+  // ptr may be reused as soon as write() returns
+  void write( cl_mem buffer , size_t offset , size_t size , void const* ptr ,
+      int* errp=nullptr )
+  {
+    pack_t& pack = pack_( errp );
+    const size_t packed = pack.bytes.size();
+    pack.bytes.resize( aligned_( packed + size ) );
+    std::memcpy( pack.bytes.data() + packed , ptr , size );
+    writes_.push_back( { buffer , offset , size , packed , nullptr } );
+    EC_SET_ERRP( errp )
+  }
+  // ptr is filled by the next flush()
+  void read( cl_mem buffer , size_t offset , size_t size , void* ptr )
+  {
+    reads_.push_back( { buffer , offset , size , read_bytes_ , ptr } );
+    read_bytes_ = aligned_( read_bytes_ + size );
+  }
+  size_t pending() const
+  {
+    return writes_.size() + reads_.size();
+  }
+
+  // enqueues every pending write , then every pending read.
+  // blocks until read destinations are filled if there are reads.
+  // the returned event completes once all pieces landed on the device
+  Event flush( detail::list_view<cl_event> const& events=nullptr , int* errp=nullptr )
+  {
+    if( writes_.empty() && reads_.empty() )
+    {
+      EC_SET_ERRP( errp )
+      return {};
+    }
+    pack_t& pack = pack_( errp );
+    const size_t data_bytes = pack.bytes.size();
+
+    std::vector< cl_ulong > desc;
+    std::vector< std::pair< cl_mem , std::pair< size_t , size_t > > > scatters;
+    std::vector< std::pair< cl_mem , std::pair< size_t , size_t > > > gathers;
+    describe_( writes_ , desc , scatters );
+    describe_( reads_ , desc , gathers );
+    // gathered data lives after the descriptors
+    const size_t desc_bytes = desc.size() * sizeof(cl_ulong);
+    const size_t read_base = data_bytes + desc_bytes;
+    for( size_t i=3*writes_.size(); i<desc.size(); i+=3 )
+    {
+      desc[i] += read_base;
+    }
+    pack.bytes.resize( read_base );
+    std::memcpy( pack.bytes.data() + data_bytes , desc.data() , desc_bytes );
+
+    const size_t total = read_base + read_bytes_;
+    if( total > staging_size_ )
+    {
+      staging_size_ = std::max( total , staging_size_*2 );
+      // the old buffer lives on until commands using it completed
+      staging_ = Buffer( context_ , CL_MEM_READ_WRITE , staging_size_ , nullptr , errp );
+      if( !staging_ )
+      {
+        staging_size_ = 0;
+        return {};
+      }
+    }
+
+    // on out-of-order queues the upload must not overwrite descriptors and
+    // data the previous flush's scatters still read
+    std::vector< cl_event > wait( events.data() , events.data() + events.size() );
+    if( last_ )
+    {
+      wait.push_back( last_.get() );
+    }
+    Event upload = queue_.write_buffer( staging_ , CL_FALSE , 0 , read_base ,
+        pack.bytes.data() , wait , errp );
+    if( !upload )
+    {
+      return {};
+    }
+    pack.fence = upload.share();
+
+    std::vector< Event > launched;
+    std::vector< cl_event > done;
+    for( auto const& s : scatters )
+    {
+      Event ev = launch_( scatter_ , s.first , data_bytes + s.second.first*3*sizeof(cl_ulong) ,
+          s.second.second , upload.get() , errp );
+      if( !ev )
+      {
+        return {};
+      }
+      done.push_back( ev.get() );
+      launched.push_back( std::move( ev ) );
+    }
+    Event ret = done.empty() ? Event( upload.get() ) : queue_.marker( done , errp );
+    if( !ret )
+    {
+      return {};
+    }
+    last_ = ret.share();
+
+    if( !reads_.empty() )
+    {
+      // gathers run after the scatters of the same flush
+      std::vector< cl_event > gathered;
+      for( auto const& g : gathers )
+      {
+        Event ev = launch_( gather_ , g.first , data_bytes + g.second.first*3*sizeof(cl_ulong) ,
+            g.second.second , ret.get() , errp );
+        if( !ev )
+        {
+          return {};
+        }
+        gathered.push_back( ev.get() );
+        launched.push_back( std::move( ev ) );
+      }
+      readback_.resize( read_bytes_ );
+      Event back = queue_.read_buffer( staging_ , CL_TRUE , read_base , read_bytes_ ,
+          readback_.data() , gathered , errp );
+      if( !back )
+      {
+        return {};
+      }
+      for( auto const& r : reads_ )
+      {
+        std::memcpy( r.ptr , readback_.data() + r.packed , r.size );
+      }
+    }
+
+    writes_.clear();
+    reads_.clear();
+    read_bytes_ = 0;
+    current_ ^= 1;
+    packs_[ current_ ].bytes.clear();
+    EC_SET_ERRP( errp )
+    return ret;
+  }
+};
+
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "definitions.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace ec
+{
+
+// streams many small host updates to the device with one transfer per flush.
+// the host side is a CL_MEM_ALLOC_HOST_PTR buffer kept mapped for the ring's
+// lifetime; allocations are pointer bumps in it. flush() copies everything
+// written since the previous flush into a device-side twin of the same size ,
+// whose ( buffer() , offset ) pairs are what kernels and copies consume.
+//
+// the ring is split into segments; each remembers the flush that last read
+// it , and the bump pointer waits for that flush only when it re-enters the
+// segment after wrapping around.
+// device-side reuse relies on queue order: on an out-of-order queue , pass
+// the consumers of the previous lap to flush().
+class UploadRing
+{
+public:
+  struct Allocation
+  {
+    cl_mem buffer;
+    size_t offset;
+    size_t size;
+    // host address to fill before the next flush()
+    void* ptr;
+  };
+
+protected:
+  CommandQueue queue_;
+  Buffer host_;
+  Buffer device_;
+  char* ptr_ = nullptr;
+  size_t capacity_;
+  size_t segment_size_;
+  size_t alignment_ = 1;
+  std::vector< detail::SharedEvent > fences_;
+
+  size_t cursor_ = 0;
+  // unflushed bytes are [dirty_,wrap_) + [0,cursor_) after a wrap ,
+  // [dirty_,cursor_) otherwise
+  size_t dirty_ = 0;
+  size_t wrap_ = 0;
+  bool wrapped_ = false;
+  size_t segment_ = SIZE_MAX;
+  size_t stalls_ = 0;
+
+  size_t pending_() const
+  {
+    return wrapped_ ? ( wrap_ - dirty_ ) + cursor_ : cursor_ - dirty_;
+  }
+  void fence_range_( size_t begin , size_t end , cl_event event )
+  {
+    for( size_t s=begin/segment_size_; s*segment_size_<end; ++s )
+    {
+      fences_[s] = detail::SharedEvent( event );
+    }
+  }
+  Event write_( size_t begin , size_t end ,
+      detail::list_view<cl_event> const& events , int* errp )
+  {
+    return queue_.write_buffer( device_ , CL_FALSE , begin , end - begin , ptr_ + begin ,
+        events , errp );
+  }
+
+public:
+  // capacity is rounded up to whole segments of alignment-sized units
+  UploadRing( CommandQueue queue ,
+      size_t capacity=size_t(4)<<20 ,
+      size_t segments=8 ,
+      int* errp=nullptr )
+    : queue_( std::move( queue ) )
+  {
+    // reported in bits; keeps every offset usable as a sub-buffer origin
+    const cl_uint bits = queue_.device( errp ).get_info< CL_DEVICE_MEM_BASE_ADDR_ALIGN >( errp );
+    alignment_ = std::max< size_t >( bits / 8 , 1 );
+    segments = std::max< size_t >( segments , 2 );
+    segment_size_ = ( capacity / segments + alignment_ - 1 ) / alignment_ * alignment_;
+    segment_size_ = std::max( segment_size_ , alignment_ );
+    capacity_ = segment_size_ * segments;
+    fences_.resize( segments );
+
+    const Context context = queue_.context( errp );
+    host_ = Buffer( context , CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR , capacity_ ,
+        nullptr , errp );
+    device_ = Buffer( context , CL_MEM_READ_ONLY , capacity_ , nullptr , errp );
+    if( host_ && device_ )
+    {
+      ptr_ = queue_.map_buffer< char >( host_ , CL_TRUE , CL_MAP_WRITE , 0 , capacity_ ,
+          nullptr , errp );
+    }
+  }
+  UploadRing( UploadRing const& ) = delete;
+  UploadRing& operator=( UploadRing const& ) = delete;
+  ~UploadRing()
+  {
+    if( ptr_ )
+    {
+      clEnqueueUnmapMemObject( queue_ , host_ , ptr_ , 0 , nullptr , nullptr );
+    }
+    queue_.finish();
+  }
+
+  // room for size bytes; flushes first if the ring would overrun
+  // data that was not flushed yet
+  Allocation allocate( size_t size , int* errp=nullptr )
+  {
+    size = ( std::max< size_t >( size , 1 ) + alignment_ - 1 ) / alignment_ * alignment_;
+    if( size > capacity_ - segment_size_ )
+    {
+      EC_CHECK_ERROR( CL_INVALID_BUFFER_SIZE , errp , return {} )
+    }
+    const bool wrap = cursor_ + size > capacity_;
+    const size_t waste = wrap ? capacity_ - cursor_ : 0;
+    if( pending_() + waste + size > capacity_ - segment_size_ || ( wrap && wrapped_ ) )
+    {
+      int err;
+      flush( nullptr , &err );
+      EC_CHECK_ERROR( err , errp , return {} )
+    }
+    if( wrap )
+    {
+      if( pending_() > 0 )
+      {
+        wrap_ = cursor_;
+        wrapped_ = true;
+      }
+      else
+      {
+        dirty_ = 0;
+      }
+      cursor_ = 0;
+      // the segment of the previous lap is re-entered like any other
+      segment_ = SIZE_MAX;
+    }
+    const size_t offset = cursor_;
+    // entering a segment last read by a flush that may still run; the
+    // segment the cursor is in was entered already , its fence covers only
+    // bytes before the cursor
+    for( size_t s=offset/segment_size_; s*segment_size_<offset+size; ++s )
+    {
+      if( s == segment_ || !fences_[s] )
+      {
+        continue;
+      }
+      if( fences_[s].execution_status() != CL_COMPLETE )
+      {
+        ++stalls_;
+      }
+      int err;
+      fences_[s].wait( &err );
+      EC_CHECK_ERROR( err , errp , return {} )
+      fences_[s] = detail::SharedEvent();
+    }
+    segment_ = ( offset + size - 1 ) / segment_size_;
+    cursor_ = offset + size;
+    EC_SET_ERRP( errp )
+    return { device_.get() , offset , size , ptr_ + offset };
+  }
+  Allocation push( void const* data , size_t size , int* errp=nullptr )
+  {
+    Allocation ret = allocate( size , errp );
+    if( ret.ptr )
+    {
+      std::memcpy( ret.ptr , data , size );
+    }
+    return ret;
+  }
+
+  // one write per contiguous unflushed range , two right after a wrap.
+  // the returned event completes once the device copy is up to date
+  Event flush( detail::list_view<cl_event> const& events=nullptr , int* errp=nullptr )
+  {
+    if( pending_() == 0 )
+    {
+      EC_SET_ERRP( errp )
+      return {};
+    }
+    Event ret;
+    if( wrapped_ )
+    {
+      Event first = write_( dirty_ , wrap_ , events , errp );
+      if( !first )
+      {
+        return {};
+      }
+      Event second = write_( 0 , cursor_ , events , errp );
+      if( !second )
+      {
+        return {};
+      }
+      const cl_event both[] = { first.get() , second.get() };
+      ret = queue_.marker( both , errp );
+      if( !ret )
+      {
+        return {};
+      }
+      fence_range_( dirty_ , wrap_ , ret );
+      fence_range_( 0 , cursor_ , ret );
+    }
+    else
+    {
+      ret = write_( dirty_ , cursor_ , events , errp );
+      if( !ret )
+      {
+        return {};
+      }
+      fence_range_( dirty_ , cursor_ , ret );
+    }
+    dirty_ = cursor_;
+    wrapped_ = false;
+    queue_.flush();
+    return ret;
+  }
+
+  // device-side ring , the buffer of every Allocation
+  Buffer const& buffer() const
+  {
+    return device_;
+  }
+  size_t capacity() const
+  {
+    return capacity_;
+  }
+  size_t alignment() const
+  {
+    return alignment_;
+  }
+  // bytes allocated since the last flush
+  size_t pending() const
+  {
+    return pending_();
+  }
+  // allocations that waited for a flush still in flight
+  size_t stalls() const
+  {
+    return stalls_;
+  }
+};
+
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include "cl.hpp"
+#include "global.hpp"
+#include "event.hpp"
+#include "command_queue.hpp"
+#include "list_view.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+namespace ec
+{
+
+// how a host thread waits for commands.
+// BLOCK    sleeps in clWaitForEvents , or on a condition variable with a timeout
+// SPIN     polls execution_status() with a pause between polls
+// ADAPTIVE spins for the spin budget , then blocks for the rest of the timeout
+struct WaitPolicy
+{
+  enum mode_t { BLOCK , SPIN , ADAPTIVE };
+  constexpr static std::chrono::nanoseconds infinite()
+  {
+    return std::chrono::nanoseconds::max();
+  }
+
+  mode_t mode;
+  std::chrono::nanoseconds spin;
+  std::chrono::nanoseconds timeout;
+
+  constexpr WaitPolicy( mode_t m=ADAPTIVE ,
+      std::chrono::nanoseconds s=std::chrono::microseconds( 50 ) ,
+      std::chrono::nanoseconds t=infinite() )
+    : mode( m ) ,
+      spin( s ) ,
+      timeout( t )
+  {
+  }
+
+  constexpr static WaitPolicy blocking( std::chrono::nanoseconds timeout=infinite() )
+  {
+    return { BLOCK , std::chrono::nanoseconds( 0 ) , timeout };
+  }
+  constexpr static WaitPolicy spinning( std::chrono::nanoseconds timeout=infinite() )
+  {
+    return { SPIN , infinite() , timeout };
+  }
+  constexpr static WaitPolicy adaptive(
+      std::chrono::nanoseconds spin=std::chrono::microseconds( 50 ) ,
+      std::chrono::nanoseconds timeout=infinite() )
+  {
+    return { ADAPTIVE , spin , timeout };
+  }
+};
+
+namespace detail
+{
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__( "yield" );
+#endif
+}
+
+// 1 if every event completed , 0 if some is pending , negative on error.
+// first is the index of the first event not yet seen complete
+inline int poll_events_( list_view<cl_event> const& events , size_type& first )
+{
+  for( ; first<events.size(); ++first )
+  {
+    cl_int status;
+    const int err = clGetEventInfo( events.data()[first] ,
+        CL_EVENT_COMMAND_EXECUTION_STATUS , sizeof(status) , &status , nullptr );
+    if( err != CL_SUCCESS )
+    {
+      return err;
+    }
+    if( status < 0 )
+    {
+      return CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST;
+    }
+    if( status != CL_COMPLETE )
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// polling never submits anything by itself , unlike clWaitForEvents
+inline void flush_queues_( list_view<cl_event> const& events )
+{
+  cl_command_queue last = NULL;
+  for( size_type i=0; i<events.size(); ++i )
+  {
+    cl_command_queue queue = NULL;
+    clGetEventInfo( events.data()[i] , CL_EVENT_COMMAND_QUEUE ,
+        sizeof(queue) , &queue , nullptr );
+    if( queue != NULL && queue != last )
+    {
+      clFlush( queue );
+      last = queue;
+    }
+  }
+}
+
+// shared between the waiting thread and the completion callbacks;
+// outlives a timed-out wait until the last callback fired
+struct wait_state_
+{
+  std::mutex mutex;
+  std::condition_variable cv;
+  cl_uint remaining;
+  std::atomic< cl_uint > refs;
+
+  explicit wait_state_( cl_uint count )
+    : remaining( count ) ,
+      refs( count + 1 )
+  {
+  }
+  void unref()
+  {
+    if( refs.fetch_sub( 1 ) == 1 )
+    {
+      delete this;
+    }
+  }
+  static void callback( cl_event , cl_int , void* userdata )
+  {
+    wait_state_* self = static_cast< wait_state_* >( userdata );
+    {
+      std::lock_guard< std::mutex > lock( self->mutex );
+      --self->remaining;
+    }
+    self->cv.notify_all();
+    self->unref();
+  }
+};
+
+// 1 if every event completed , 0 on timeout , negative on error
+template < typename Clock >
+int block_until_( list_view<cl_event> const& events , size_type first ,
+    bool bounded , typename Clock::time_point deadline )
+{
+  if( !bounded )
+  {
+    const int err = clWaitForEvents( events.size() - first , events.data() + first );
+    return err == CL_SUCCESS ? 1 : err;
+  }
+  const cl_uint count = events.size() - first;
+  wait_state_* state = new wait_state_( count );
+  int ret = 1;
+  for( size_type i=first; i<events.size(); ++i )
+  {
+    const int err = clSetEventCallback( events.data()[i] , CL_COMPLETE ,
+        wait_state_::callback , state );
+    if( err != CL_SUCCESS )
+    {
+      ret = err;
+      // callbacks never registered will not drop their reference
+      for( size_type j=i; j<events.size(); ++j )
+      {
+        state->unref();
+      }
+      break;
+    }
+  }
+  if( ret == 1 )
+  {
+    std::unique_lock< std::mutex > lock( state->mutex );
+    if( !state->cv.wait_until( lock , deadline , [state]{ return state->remaining == 0; } ) )
+    {
+      ret = 0;
+    }
+  }
+  state->unref();
+  if( ret == 1 )
+  {
+    // completion callbacks also fire for failed commands
+    ret = poll_events_( events , first );
+  }
+  return ret;
+}
+
+}
+
+// plain clWaitForEvents
+inline void wait_for_events( detail::list_view<cl_event> const& events , int* errp=nullptr )
+{
+  if( events.size() == 0 )
+  {
+    EC_SET_ERRP( errp )
+    return;
+  }
+  const int err = clWaitForEvents( events.size() , events.data() );
+  EC_CHECK_ERROR( err , errp , return )
+  EC_SET_ERRP( errp )
+}
+
+// waits until every event completed , following policy.
+// returns false if policy.timeout elapsed first; that is not an error.
+// a failed command reports CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST
+inline bool wait( detail::list_view<cl_event> const& events ,
+    WaitPolicy const& policy=WaitPolicy() ,
+    int* errp=nullptr )
+{
+  using clock = std::chrono::steady_clock;
+
+  if( policy.mode == WaitPolicy::BLOCK && policy.timeout == WaitPolicy::infinite() )
+  {
+    wait_for_events( events , errp );
+    return true;
+  }
+
+  const clock::time_point now = clock::now();
+  const bool bounded = policy.timeout != WaitPolicy::infinite();
+  const clock::time_point deadline = bounded ? now + policy.timeout : clock::time_point::max();
+  clock::time_point spin_deadline = now;
+  if( policy.mode == WaitPolicy::SPIN )
+  {
+    spin_deadline = deadline;
+  }
+  else if( policy.mode == WaitPolicy::ADAPTIVE )
+  {
+    spin_deadline = std::min( deadline , policy.spin == WaitPolicy::infinite() ?
+        clock::time_point::max() : now + policy.spin );
+  }
+
+  detail::size_type first = 0;
+  int ret = detail::poll_events_( events , first );
+  bool flushed = false;
+  if( ret == 0 && spin_deadline > now )
+  {
+    detail::flush_queues_( events );
+    flushed = true;
+    unsigned pauses = 1;
+    while( ret == 0 && clock::now() < spin_deadline )
+    {
+      for( unsigned i=0; i<pauses; ++i )
+      {
+        detail::cpu_relax();
+      }
+      // back off up to a few hundred cycles between polls
+      if( pauses < 64 )
+      {
+        pauses *= 2;
+      }
+      ret = detail::poll_events_( events , first );
+    }
+  }
+  if( ret == 0 && policy.mode != WaitPolicy::SPIN && clock::now() < deadline )
+  {
+    // commands never flushed might not be submitted while we sleep
+    if( !flushed )
+    {
+      detail::flush_queues_( events );
+    }
+    ret = detail::block_until_< clock >( events , first , bounded , deadline );
+  }
+  if( ret < 0 )
+  {
+    EC_CHECK_ERROR( ret , errp , return false )
+  }
+  EC_SET_ERRP( errp )
+  return ret == 1;
+}
+
+// waits for every command enqueued so far , through a marker
+inline bool wait( CommandQueue const& queue ,
+    WaitPolicy const& policy=WaitPolicy() ,
+    int* errp=nullptr )
+{
+  if( policy.mode == WaitPolicy::BLOCK && policy.timeout == WaitPolicy::infinite() )
+  {
+    queue.finish();
+    EC_SET_ERRP( errp )
+    return true;
+  }
+  bool ret;
+  {
+    int err;
+    Event marker = queue.marker( nullptr , &err );
+    EC_CHECK_ERROR( err , errp , return false )
+    ret = wait( marker , policy , errp );
+  }
+  detail::EventReleaseList::drain_local();
+  return ret;
+}
+
+}
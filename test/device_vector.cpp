@@ -0,0 +1,31 @@
+#include "test.hpp"
+#include <vector>
+
+// an empty vector has no buffer; nothing may reach the queue
+static void empty()
+{
+  ec::CommandQueue queue = ec_test::first_queue();
+  ec::device_vector< int > v( queue );
+  EC_TEST_CHECK( v.to_host().empty() );
+  EC_TEST_CHECK( !v.fill( 3 ) );
+  int out = 0;
+  EC_TEST_CHECK( !v.read( &out , 0 , 0 ) );
+
+  int err = CL_INVALID_VALUE;
+  const int data[] = { 1 , 2 };
+  EC_TEST_CHECK( !v.assign( data , 0 , nullptr , &err ) );
+  EC_TEST_CHECK( err == CL_SUCCESS );
+  EC_TEST_CHECK( v.size() == 0 );
+
+  // emptied again after holding elements
+  v.assign( data , 2 ).wait();
+  v.assign( data , 0 );
+  EC_TEST_CHECK( v.to_host().empty() );
+  EC_TEST_CHECK( !v.fill( 3 , 0 , 0 ) );
+}
+
+int main()
+{
+  empty();
+  return ec_test::report();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// each test is a standalone program against the first OpenCL device:
+//   c++ -std=c++14 -I.. upload_ring.cpp ../ec/cl.cpp -lOpenCL -lpthread
+// it prints the failed checks and exits non-zero if there were any.
+
+#include <algorithm>
+#include "ec.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+namespace ec_test
+{
+
+inline int& failures()
+{
+  static int ret = 0;
+  return ret;
+}
+
+// queue on the first device of the first platform
+inline ec::CommandQueue first_queue()
+{
+  const ec::Device device = ec::Platform::get_platforms().at( 0 ).get_devices().at( 0 );
+  const cl_device_id id = device.get();
+  const ec::Context context( nullptr , id , nullptr , nullptr );
+  return ec::CommandQueue( context , id );
+}
+
+inline int report()
+{
+  if( failures() == 0 )
+  {
+    std::printf( "ok\n" );
+  }
+  return failures() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}
+
+#define EC_TEST_CHECK( Exp ) \
+    if( !( Exp ) ) \
+    { std::printf( "%s:%d: check failed: %s\n" , __FILE__ , __LINE__ , #Exp ); \
+      ++::ec_test::failures(); }
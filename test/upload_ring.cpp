@@ -0,0 +1,43 @@
+#include "test.hpp"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// wrapping into the segment the cursor was in on the previous lap must wait
+// for the flush still reading that segment
+static void wrap_into_last_segment()
+{
+  ec::CommandQueue queue = ec_test::first_queue();
+  ec::UploadRing ring( queue , size_t(8) << 16 , 8 );
+  const size_t segment = ring.capacity() / 8;
+  const std::vector< char > data( ring.capacity() , 1 );
+
+  // segments 0 to 2 , read by a flush that completed
+  ring.push( data.data() , 3 * segment );
+  ring.flush().wait();
+  // half of segment 3 , read by a flush held back by gate
+  const ec::Event gate( queue.context() );
+  ring.push( data.data() , segment / 2 );
+  ring.flush( gate );
+
+  std::atomic< bool > released( false );
+  std::thread releaser( [&]
+      {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+        released = true;
+        gate.complete();
+      } );
+  // wraps to 0 and covers segments 0 to 4
+  const ec::UploadRing::Allocation a = ring.allocate( 4 * segment + segment * 5 / 8 );
+  EC_TEST_CHECK( a.offset == 0 );
+  EC_TEST_CHECK( released );
+  EC_TEST_CHECK( ring.stalls() == 1 );
+  releaser.join();
+}
+
+int main()
+{
+  wrap_into_last_segment();
+  return ec_test::report();
+}